@@ -302,11 +302,42 @@ fs_init(void)
 	read_bitmap();
 }
 
+// Set '*pslot' to point to entry 'idx' of the indirect block whose
+// block number is stored in '*pbno'.
+// When 'alloc' is set, allocate and clear the indirect block if '*pbno'
+// is 0.
+// Returns 0 on success, -E_NOT_FOUND if the indirect block did not
+// exist and alloc was 0, or -E_NO_DISK or -E_NO_MEM.
+static int
+indirect_slot(uint32_t *pbno, uint32_t idx, uint32_t **pslot, bool alloc)
+{
+	int r;
+	char *blk;
+
+	if (*pbno == 0) {
+		if (!alloc)
+			return -E_NOT_FOUND;
+		if ((r = alloc_block()) < 0)
+			return r; // -E_NO_DISK or -E_NO_MEM;
+		*pbno = (uint32_t) r;
+		if ((r = read_block(*pbno, &blk)) < 0)
+			return r;
+		memset(blk, 0, PGSIZE);
+	} else if ((r = read_block(*pbno, &blk)) < 0)
+		return r;
+	*pslot = &((uint32_t *) blk)[idx];
+	return 0;
+}
+
 // Find the disk block number slot for the 'filebno'th block in file 'f'.
 // Set '*ppdiskbno' to point to that slot.
 // The slot will be one of the f->f_direct[] entries,
-// or an entry in the indirect block.
-// When 'alloc' is set, this function will allocate an indirect block
+// an entry in the indirect block,
+// or an entry in one of the blocks the double-indirect block points to.
+// Blocks below NINDIRECT are found through f_direct and f_indirect
+// (the first NDIRECT entries of the indirect block are unused);
+// the next NDINDIRECT blocks are found through f_dindirect.
+// When 'alloc' is set, this function will allocate indirect blocks
 // if necessary.
 //
 // Returns:
@@ -315,7 +346,7 @@ fs_init(void)
 //		alloc was 0.
 //	-E_NO_DISK if there's no space on the disk for an indirect block.
 //	-E_NO_MEM if there's no space in memory for an indirect block.
-//	-E_INVAL if filebno is out of range (it's >= NINDIRECT).
+//	-E_INVAL if filebno is out of range (it's >= NINDIRECT + NDINDIRECT).
 //
 // Analogy: This is like pgdir_walk for files.  
 // Hint: Don't forget to clear any block you allocate.
@@ -324,40 +355,24 @@ file_block_walk(struct File *f, uint32_t filebno, uint32_t **ppdiskbno, bool all
 {
 	// LAB 5: Your code here.
 	int r;
-	char *blk;
-
-	if (filebno >= NINDIRECT)
-		return -E_INVAL;
+	uint32_t *pbno;
 
 	if (filebno < NDIRECT) {
 		// In the direct block range
 		*ppdiskbno = &(f->f_direct[filebno]);
 		return 0;
-	} else {
-		// In the indirect block range;
-		if (f->f_indirect == 0) {
-			// indirect block not allocated yet
-			if (alloc == 0) {
-				return -E_NOT_FOUND;
-			} else {
-				if ((r = alloc_block()) < 0)
-					return r; // -E_NO_DISK or -E_NO_MEM;
-
-				f->f_indirect = (uint32_t)r; // blockno for indirect block
-				if ((r = read_block(f->f_indirect, &blk)) < 0)
-					return r;
-				memset(blk, 0, PGSIZE);
-				*ppdiskbno = &(((uint32_t *)blk)[filebno]);
-				return 0;
-			}
-		} else {
-			// indirect block has been allocated
-			if ((r = read_block(f->f_indirect, &blk)) < 0)
-				return r;
-			*ppdiskbno = &(((uint32_t *)blk)[filebno]);
-			return 0;
-		}
-	}
+	} else if (filebno < NINDIRECT) {
+		// In the indirect block range
+		return indirect_slot(&f->f_indirect, filebno, ppdiskbno, alloc);
+	} else if (filebno < NINDIRECT + NDINDIRECT) {
+		// In the double-indirect block range
+		filebno -= NINDIRECT;
+		if ((r = indirect_slot(&f->f_dindirect, filebno / NINDIRECT,
+				       &pbno, alloc)) < 0)
+			return r;
+		return indirect_slot(pbno, filebno % NINDIRECT, ppdiskbno, alloc);
+	} else
+		return -E_INVAL;
 }
 
 // Set '*diskbno' to the disk block number for the 'filebno'th block
@@ -407,7 +422,7 @@ file_clear_block(struct File *f, uint32_t filebno)
 	uint32_t *ptr;
 
 	if ((r = file_block_walk(f, filebno, &ptr, 0)) < 0)
-		return r;
+		return (r == -E_NOT_FOUND ? 0 : r);
 	if (*ptr) {
 		free_block(*ptr);
 		*ptr = 0;
@@ -460,6 +475,191 @@ file_dirty(struct File *f, off_t offset)
 	return 0;
 }
 
+// In-memory directory index.
+//
+// A directory is searched by hashing the name into one of DIRHASH
+// buckets instead of comparing against every 'struct File' in every
+// directory block.  Indexes are built lazily, the first time
+// dir_lookup() is asked about a directory, and at most NDIRINDEX
+// directories are indexed at once (the oldest index is recycled).
+// Besides the name buckets, each index keeps a list of the empty
+// slots in the directory so dir_alloc_file() need not scan either.
+// file_create() and file_remove() keep the indexes current.
+//
+// Index entries point straight into the directory blocks, which stay
+// mapped at their DISKMAP address once read.  An index is keyed by the
+// directory's first block rather than its 'struct File', whose slot
+// may be reused by another directory once this one is removed (along
+// with the slots of any subdirectories, whose indexes are not dropped).
+// Empty directories have no first block and are not indexed.  If we
+// run out of memory while updating an index, we throw the index away
+// and fall back to scanning the directory.
+
+#define NDIRINDEX	16		// number of directories indexed at once
+#define DIRHASH		64		// buckets per directory; power of 2
+
+struct DirEnt {
+	struct File *de_file;		// named entry, or empty slot
+	LIST_ENTRY(DirEnt) de_link;	// bucket or free-slot list link
+};
+
+LIST_HEAD(DirEnt_list, DirEnt);
+
+struct DirIndex {
+	uint32_t di_blkno;		// indexed directory's first block,
+					// 0 if unused
+	struct DirEnt_list di_hash[DIRHASH];
+	struct DirEnt_list di_free;	// empty slots in the directory
+};
+
+static struct DirIndex dirindex[NDIRINDEX];
+static int dirindex_next;		// next index to recycle
+
+static uint32_t
+strhash(const char *s)
+{
+	uint32_t h = 5381;
+
+	while (*s)
+		h = h * 33 + (uint8_t) *s++;
+	return h;
+}
+
+#define dirhash(name)	(strhash(name) & (DIRHASH - 1))
+
+// Free all entries of index 'di' and mark it unused.
+static void
+dirindex_clear(struct DirIndex *di)
+{
+	struct DirEnt *de;
+	int i;
+
+	for (i = 0; i < DIRHASH; i++)
+		while ((de = LIST_FIRST(&di->di_hash[i])) != NULL) {
+			LIST_REMOVE(de, de_link);
+			free(de);
+		}
+	while ((de = LIST_FIRST(&di->di_free)) != NULL) {
+		LIST_REMOVE(de, de_link);
+		free(de);
+	}
+	di->di_blkno = 0;
+}
+
+// Return the index for 'dir', or 0 if 'dir' is not indexed.
+static struct DirIndex *
+dirindex_find(struct File *dir)
+{
+	int i;
+
+	if (dir->f_direct[0] == 0)
+		return 0;
+	for (i = 0; i < NDIRINDEX; i++)
+		if (dirindex[i].di_blkno == dir->f_direct[0])
+			return &dirindex[i];
+	return 0;
+}
+
+// Add slot 'f' to index 'di': to its name's bucket if the slot is
+// in use, to the free-slot list if not.
+// Returns 0 on success, -E_NO_MEM if out of memory.
+static int
+dirindex_add(struct DirIndex *di, struct File *f)
+{
+	struct DirEnt *de;
+
+	if ((de = malloc(sizeof(struct DirEnt))) == 0)
+		return -E_NO_MEM;
+	de->de_file = f;
+	if (f->f_name[0] == '\0')
+		LIST_INSERT_HEAD(&di->di_free, de, de_link);
+	else
+		LIST_INSERT_HEAD(&di->di_hash[dirhash(f->f_name)], de, de_link);
+	return 0;
+}
+
+// Build an index for 'dir', recycling the oldest index if necessary.
+// Returns the new index, or 0 if it could not be built.
+static struct DirIndex *
+dirindex_build(struct File *dir)
+{
+	struct DirIndex *di;
+	uint32_t i, j, nblock;
+	char *blk;
+	struct File *f;
+
+	if (dir->f_size == 0)
+		return 0;
+	di = &dirindex[dirindex_next];
+	dirindex_next = (dirindex_next + 1) % NDIRINDEX;
+	if (di->di_blkno)
+		dirindex_clear(di);
+
+	nblock = dir->f_size / BLKSIZE;
+	for (i = 0; i < nblock; i++) {
+		if (file_get_block(dir, i, &blk) < 0)
+			goto fail;
+		f = (struct File*) blk;
+		for (j = 0; j < BLKFILES; j++)
+			if (dirindex_add(di, &f[j]) < 0)
+				goto fail;
+	}
+	di->di_blkno = dir->f_direct[0];
+	return di;
+
+fail:
+	dirindex_clear(di);
+	return 0;
+}
+
+// Record that slot 'f' in directory 'dir' has just been given a name.
+static void
+dirindex_insert(struct File *dir, struct File *f)
+{
+	struct DirIndex *di;
+	struct DirEnt *de;
+
+	if ((di = dirindex_find(dir)) == 0)
+		return;
+	LIST_FOREACH(de, &di->di_free, de_link)
+		if (de->de_file == f) {
+			LIST_REMOVE(de, de_link);
+			LIST_INSERT_HEAD(&di->di_hash[dirhash(f->f_name)], de, de_link);
+			return;
+		}
+	if (dirindex_add(di, f) < 0)
+		dirindex_clear(di);
+}
+
+// Record that slot 'f' in directory 'dir' is about to lose its name.
+static void
+dirindex_delete(struct File *dir, struct File *f)
+{
+	struct DirIndex *di;
+	struct DirEnt *de;
+
+	if ((di = dirindex_find(dir)) == 0)
+		return;
+	LIST_FOREACH(de, &di->di_hash[dirhash(f->f_name)], de_link)
+		if (de->de_file == f) {
+			LIST_REMOVE(de, de_link);
+			LIST_INSERT_HEAD(&di->di_free, de, de_link);
+			return;
+		}
+	// The index did not know about the entry; don't trust it.
+	dirindex_clear(di);
+}
+
+// Forget any index for 'dir', whose contents are going away.
+static void
+dirindex_drop(struct File *dir)
+{
+	struct DirIndex *di;
+
+	if ((di = dirindex_find(dir)) != 0)
+		dirindex_clear(di);
+}
+
 // Try to find a file named "name" in dir.  If so, set *file to it.
 int
 dir_lookup(struct File *dir, const char *name, struct File **file)
@@ -468,11 +668,25 @@ dir_lookup(struct File *dir, const char *name, struct File **file)
 	uint32_t i, j, nblock;
 	char *blk;
 	struct File *f;
+	struct DirIndex *di;
+	struct DirEnt *de;
 
-	// Search dir for name.
 	// We maintain the invariant that the size of a directory-file
 	// is always a multiple of the file system's block size.
 	assert((dir->f_size % BLKSIZE) == 0);
+
+	// Use the directory's index, building it if need be.
+	if ((di = dirindex_find(dir)) != 0 || (di = dirindex_build(dir)) != 0) {
+		LIST_FOREACH(de, &di->di_hash[dirhash(name)], de_link)
+			if (strcmp(de->de_file->f_name, name) == 0) {
+				*file = de->de_file;
+				de->de_file->f_dir = dir;
+				return 0;
+			}
+		return -E_NOT_FOUND;
+	}
+
+	// No index; search dir for name.
 	nblock = dir->f_size / BLKSIZE;
 	for (i = 0; i < nblock; i++) {
 		if ((r = file_get_block(dir, i, &blk)) < 0)
@@ -496,24 +710,43 @@ dir_alloc_file(struct File *dir, struct File **file)
 	uint32_t nblock, i, j;
 	char *blk;
 	struct File *f;
+	struct DirIndex *di;
+	struct DirEnt *de;
 
 	assert((dir->f_size % BLKSIZE) == 0);
+
+	// An indexed directory knows where its empty slots are.
+	if ((di = dirindex_find(dir)) != 0
+	    && (de = LIST_FIRST(&di->di_free)) != NULL) {
+		*file = de->de_file;
+		de->de_file->f_dir = dir;
+		return 0;
+	}
+
 	nblock = dir->f_size / BLKSIZE;
-	for (i = 0; i < nblock; i++) {
-		if ((r = file_get_block(dir, i, &blk)) < 0)
-			return r;
-		f = (struct File*) blk;
-		for (j = 0; j < BLKFILES; j++)
-			if (f[j].f_name[0] == '\0') {
-				*file = &f[j];
-				f[j].f_dir = dir;
-				return 0;
-			}
+	if (!di) {
+		for (i = 0; i < nblock; i++) {
+			if ((r = file_get_block(dir, i, &blk)) < 0)
+				return r;
+			f = (struct File*) blk;
+			for (j = 0; j < BLKFILES; j++)
+				if (f[j].f_name[0] == '\0') {
+					*file = &f[j];
+					f[j].f_dir = dir;
+					return 0;
+				}
+		}
 	}
+	i = nblock;
 	dir->f_size += BLKSIZE;
 	if ((r = file_get_block(dir, i, &blk)) < 0)
 		return r;
 	f = (struct File*) blk;
+	for (j = 0; di && j < BLKFILES; j++)
+		if (dirindex_add(di, &f[j]) < 0) {
+			dirindex_clear(di);
+			break;
+		}
 	*file = &f[0];
 	f[0].f_dir = dir;
 	return 0;
@@ -528,29 +761,76 @@ skip_slash(const char *p)
 	return p;
 }
 
-// Evaluate a path name, starting at the root.
-// On success, set *pf to the file we found
-// and set *pdir to the directory the file is in.
-// If we cannot find the file but find the directory
-// it should be in, set *pdir and copy the final path
-// element into lastelem.
+// Path-resolution cache.
+//
+// walk_path() remembers the outcome of recent walks, keyed by the path
+// with its leading slashes stripped, so that repeatedly opening the same
+// path skips the directory searches altogether.  Failed walks that got
+// as far as the final path element are cached too ("negative" entries),
+// since file_create() needs the directory they found.  The cache is
+// direct-mapped, so it holds at most NPATHCACHE paths; longer paths than
+// PATHCACHELEN are never cached.
+//
+// A negative entry goes stale when a file is created in its directory,
+// and a positive entry when its file is removed; file_create() and
+// file_remove() discard the affected entries.  Removing or truncating a
+// directory discards everything, since paths through it may be cached.
+
+#define NPATHCACHE	64
+#define PATHCACHELEN	128
+
+struct PathEnt {
+	char pe_path[PATHCACHELEN];	// path, or "" if the entry is unused
+	int pe_r;			// 0 or -E_NOT_FOUND
+	struct File *pe_dir;		// directory containing the last element
+	struct File *pe_file;		// file found, 0 if pe_r < 0
+};
+
+static struct PathEnt pathcache[NPATHCACHE];
+
+static struct PathEnt *
+pathcache_slot(const char *path)
+{
+	return &pathcache[strhash(path) % NPATHCACHE];
+}
+
+// Discard negative entries for names in directory 'dir'.
+static void
+pathcache_forget_missing(struct File *dir)
+{
+	int i;
+
+	for (i = 0; i < NPATHCACHE; i++)
+		if (pathcache[i].pe_r < 0 && pathcache[i].pe_dir == dir)
+			pathcache[i].pe_path[0] = '\0';
+}
+
+// Discard entries that resolve to file 'f'.
+static void
+pathcache_forget(struct File *f)
+{
+	int i;
+
+	for (i = 0; i < NPATHCACHE; i++)
+		if (f->f_type == FTYPE_DIR || pathcache[i].pe_file == f)
+			pathcache[i].pe_path[0] = '\0';
+}
+
+// Evaluate a path name, starting at the root, without the cache.
+// See walk_path.
 static int
-walk_path(const char *path, struct File **pdir, struct File **pf, char *lastelem)
+walk_path_uncached(const char *path, struct File **pdir, struct File **pf, char *lastelem)
 {
 	const char *p;
 	char name[MAXNAMELEN];
 	struct File *dir, *f;
 	int r;
 
-	// if (*path != '/')
-	//	return -E_BAD_PATH;
-	path = skip_slash(path);
 	f = &super->s_root;
 	dir = 0;
 	name[0] = 0;
 
-	if (pdir)
-		*pdir = 0;
+	*pdir = 0;
 	*pf = 0;
 	while (*path != '\0') {
 		dir = f;
@@ -568,8 +848,7 @@ walk_path(const char *path, struct File **pdir, struct File **pf, char *lastelem
 
 		if ((r = dir_lookup(dir, name, &f)) < 0) {
 			if (r == -E_NOT_FOUND && *path == '\0') {
-				if (pdir)
-					*pdir = dir;
+				*pdir = dir;
 				if (lastelem)
 					strcpy(lastelem, name);
 				*pf = 0;
@@ -578,12 +857,69 @@ walk_path(const char *path, struct File **pdir, struct File **pf, char *lastelem
 		}
 	}
 
-	if (pdir)
-		*pdir = dir;
+	*pdir = dir;
 	*pf = f;
 	return 0;
 }
 
+// Evaluate a path name, starting at the root.
+// On success, set *pf to the file we found
+// and set *pdir to the directory the file is in.
+// If we cannot find the file but find the directory
+// it should be in, set *pdir and copy the final path
+// element into lastelem.
+static int
+walk_path(const char *path, struct File **pdir, struct File **pf, char *lastelem)
+{
+	char name[MAXNAMELEN];
+	struct PathEnt *pe;
+	struct File *dir;
+	const char *p;
+	int r;
+
+	// if (*path != '/')
+	//	return -E_BAD_PATH;
+	path = skip_slash(path);
+	pe = pathcache_slot(path);
+
+	if (pe->pe_path[0] != '\0' && strcmp(pe->pe_path, path) == 0) {
+		if (pdir)
+			*pdir = pe->pe_dir;
+		*pf = pe->pe_file;
+		if (pe->pe_r == 0) {
+			pe->pe_file->f_dir = pe->pe_dir;
+			return 0;
+		}
+		if (lastelem) {
+			// The final element is whatever follows the last
+			// slash, ignoring trailing slashes.
+			for (p = path + strlen(path); p > path && p[-1] == '/'; p--)
+				/* do nothing */;
+			r = p - path;
+			while (p > path && p[-1] != '/')
+				p--;
+			memmove(lastelem, p, (path + r) - p);
+			lastelem[(path + r) - p] = '\0';
+		}
+		return pe->pe_r;
+	}
+
+	r = walk_path_uncached(path, &dir, pf, name);
+	if (pdir)
+		*pdir = dir;
+	if (r == -E_NOT_FOUND && dir && lastelem)
+		strcpy(lastelem, name);
+
+	if ((r == 0 || (r == -E_NOT_FOUND && dir))
+	    && path[0] != '\0' && strlen(path) < PATHCACHELEN) {
+		strcpy(pe->pe_path, path);
+		pe->pe_r = r;
+		pe->pe_dir = dir;
+		pe->pe_file = *pf;
+	}
+	return r;
+}
+
 // Create "path".  On success set *pf to point at the file and return 0.
 // On error return < 0.
 int
@@ -600,6 +936,8 @@ file_create(const char *path, struct File **pf)
 	if (dir_alloc_file(dir, &f) < 0)
 		return r;
 	strcpy(f->f_name, name);
+	dirindex_insert(dir, f);
+	pathcache_forget_missing(dir);
 	*pf = f;
 	return 0;
 }
@@ -619,6 +957,9 @@ file_open(const char *path, struct File **pf)
 // and then clear the blocks from new_nblocks to old_nblocks.
 // If the new_nblocks is no more than NDIRECT, and the indirect block has
 // been allocated (f->f_indirect != 0), then free the indirect block too.
+// Likewise free the second-level blocks of the double-indirect block that
+// are no longer needed, and the double-indirect block itself if the file
+// no longer reaches past NINDIRECT blocks.
 // (Remember to clear the f->f_indirect pointer so you'll know
 // whether it's valid!)
 // Do not change f->f_size.
@@ -626,7 +967,8 @@ static void
 file_truncate_blocks(struct File *f, off_t newsize)
 {
 	int r;
-	uint32_t bno, old_nblocks, new_nblocks;
+	uint32_t bno, old_nblocks, new_nblocks, i, keep;
+	uint32_t *blk;
 
 	// Hint: Use file_clear_block and/or free_block.
 	old_nblocks = (f->f_size + BLKSIZE - 1) / BLKSIZE;
@@ -639,13 +981,38 @@ file_truncate_blocks(struct File *f, off_t newsize)
 		free_block(f->f_indirect);
 		f->f_indirect = 0;
 	}
+
+	if (f->f_dindirect) {
+		// Number of second-level blocks still in use
+		keep = 0;
+		if (new_nblocks > NINDIRECT)
+			keep = ROUNDUP(new_nblocks - NINDIRECT, NINDIRECT) / NINDIRECT;
+		if ((r = read_block(f->f_dindirect, (char **) &blk)) < 0) {
+			cprintf("warning: file_truncate_blocks: %e", r);
+			return;
+		}
+		for (i = keep; i < NINDIRECT; i++)
+			if (blk[i]) {
+				free_block(blk[i]);
+				blk[i] = 0;
+			}
+		if (keep == 0) {
+			free_block(f->f_dindirect);
+			f->f_dindirect = 0;
+		}
+	}
 }
 
 int
 file_set_size(struct File *f, off_t newsize)
 {
-	if (f->f_size > newsize)
+	if (f->f_size > newsize) {
+		if (f->f_type == FTYPE_DIR) {
+			pathcache_forget(f);
+			dirindex_drop(f);
+		}
 		file_truncate_blocks(f, newsize);
+	}
 	f->f_size = newsize;
 	if (f->f_dir)
 		file_flush(f->f_dir);
@@ -664,12 +1031,26 @@ file_flush(struct File *f)
 	int i;
 	uint32_t diskbno;
 
+	uint32_t *blk;
+
 	for (i = 0; i < (f->f_size + BLKSIZE - 1) / BLKSIZE; i++) {
 		if (file_map_block(f, i, &diskbno, 0) < 0)
 			continue;
 		if (block_is_dirty(diskbno))
 			write_block(diskbno);
-	}	
+	}
+
+	// Also write out any indirect blocks that changed.
+	if (f->f_indirect && block_is_dirty(f->f_indirect))
+		write_block(f->f_indirect);
+	if (f->f_dindirect) {
+		blk = (uint32_t *) diskaddr(f->f_dindirect);
+		for (i = 0; block_is_mapped(f->f_dindirect) && i < NINDIRECT; i++)
+			if (blk[i] && block_is_dirty(blk[i]))
+				write_block(blk[i]);
+		if (block_is_dirty(f->f_dindirect))
+			write_block(f->f_dindirect);
+	}
 }
 
 // Sync the entire file system.  A big hammer.
@@ -701,6 +1082,11 @@ file_remove(const char *path)
 	if ((r = walk_path(path, 0, &f, 0)) < 0)
 		return r;
 
+	pathcache_forget(f);
+	if (f->f_type == FTYPE_DIR)
+		dirindex_drop(f);
+	if (f->f_dir)
+		dirindex_delete(f->f_dir, f);
 	file_truncate_blocks(f, 0);
 	f->f_name[0] = '\0';
 	f->f_size = 0;
@@ -16,10 +16,17 @@ struct OpenFile {
 	struct File *o_file;	// mapped descriptor for open file
 	int o_mode;		// open mode
 	struct Fd *o_fd;	// Fd page
+	LIST_ENTRY(OpenFile) o_link;	// free or in-use list link
 };
 
-// Max number of open files in the file system at once
+LIST_HEAD(OpenFile_list, OpenFile);
+
+// Max number of open files in the file system at once.
+// May be raised at build time (-DMAXOPEN=n); each open file uses
+// one page of address space above FILEVA.
+#ifndef MAXOPEN
 #define MAXOPEN		1024
+#endif
 #define FILEVA		0xD0000000
 
 // initialize to force into data section
@@ -27,6 +34,12 @@ struct OpenFile opentab[MAXOPEN] = {
 	{ 0, 0, 1, 0 }
 };
 
+// Open-file table entries known to be free, and entries handed out
+// to clients.  An entry handed out becomes free again once no client
+// maps its Fd page, which openfile_reclaim notices lazily.
+static struct OpenFile_list openfile_free;
+static struct OpenFile_list openfile_used;
+
 // Virtual address at which to receive page mappings containing client requests.
 #define REQVA		0x0ffff000
 
@@ -35,34 +48,62 @@ serve_init(void)
 {
 	int i;
 	uintptr_t va = FILEVA;
+
+	static_assert(FILEVA + MAXOPEN * PGSIZE <= USTACKTOP - PGSIZE);
+
+	LIST_INIT(&openfile_free);
+	LIST_INIT(&openfile_used);
 	for (i = 0; i < MAXOPEN; i++) {
 		opentab[i].o_fileid = i;
 		opentab[i].o_fd = (struct Fd*) va;
 		va += PGSIZE;
 	}
+	// Hand out low-numbered entries first.
+	for (i = MAXOPEN - 1; i >= 0; i--)
+		LIST_INSERT_HEAD(&openfile_free, &opentab[i], o_link);
 }
 
-// Allocate an open file.
-int
-openfile_alloc(struct OpenFile **o)
+// Move every in-use entry whose Fd page is no longer mapped by any
+// client (its reference count is down to the server's own mapping)
+// back onto the free list.
+static void
+openfile_reclaim(void)
 {
-	int i, r;
+	struct OpenFile *o, *next;
 
-	// Find an available open-file table entry
-	for (i = 0; i < MAXOPEN; i++) {
-		switch (pageref(opentab[i].o_fd)) {
-		case 0:
-			if ((r = sys_page_alloc(0, opentab[i].o_fd, PTE_P|PTE_U|PTE_W)) < 0)
-				return r;
-			/* fall through */
-		case 1:
-			opentab[i].o_fileid += MAXOPEN;
-			*o = &opentab[i];
-			memset(opentab[i].o_fd, 0, PGSIZE);
-			return (*o)->o_fileid;
+	for (o = LIST_FIRST(&openfile_used); o; o = next) {
+		next = LIST_NEXT(o, o_link);
+		if (pageref(o->o_fd) <= 1) {
+			LIST_REMOVE(o, o_link);
+			LIST_INSERT_HEAD(&openfile_free, o, o_link);
 		}
 	}
-	return -E_MAX_OPEN;
+}
+
+// Allocate an open file.
+int
+openfile_alloc(struct OpenFile **po)
+{
+	int r;
+	struct OpenFile *o;
+
+	// Take an entry off the free list, reclaiming closed files
+	// only once the list runs dry.
+	if (LIST_EMPTY(&openfile_free))
+		openfile_reclaim();
+	if ((o = LIST_FIRST(&openfile_free)) == NULL)
+		return -E_MAX_OPEN;
+
+	if (pageref(o->o_fd) == 0
+	    && (r = sys_page_alloc(0, o->o_fd, PTE_P|PTE_U|PTE_W)) < 0)
+		return r;
+	LIST_REMOVE(o, o_link);
+	LIST_INSERT_HEAD(&openfile_used, o, o_link);
+
+	o->o_fileid += MAXOPEN;
+	*po = o;
+	memset(o->o_fd, 0, PGSIZE);
+	return o->o_fileid;
 }
 
 // Look up an open file for envid.
@@ -78,30 +119,22 @@ openfile_lookup(envid_t envid, uint32_t fileid, struct OpenFile **po)
 	return 0;
 }
 
-// Serve requests, sending responses back to envid.
-// To send a result back, ipc_send(envid, r, 0, 0).
-// To include a page, ipc_send(envid, r, srcva, perm).
-void
-serve_open(envid_t envid, struct Fsreq_open *rq)
+// Open 'path' with mode 'omode' in a newly allocated open file,
+// and set *po to it.
+// Returns the file ID on success, < 0 on error.
+static int
+openfile_open(const char *path, int omode, struct OpenFile **po)
 {
-	char path[MAXPATHLEN];
 	struct File *f;
 	int fileid;
 	int r;
 	struct OpenFile *o;
 
-	if (debug)
-		cprintf("serve_open %08x %s 0x%x\n", envid, rq->req_path, rq->req_omode);
-
-	// Copy in the path, making sure it's null-terminated
-	memmove(path, rq->req_path, MAXPATHLEN);
-	path[MAXPATHLEN-1] = 0;
-
 	// Find an open file ID
 	if ((r = openfile_alloc(&o)) < 0) {
 		if (debug)
 			cprintf("openfile_alloc failed: %e", r);
-		goto out;
+		return r;
 	}
 	fileid = r;
 
@@ -109,7 +142,7 @@ serve_open(envid_t envid, struct Fsreq_open *rq)
 	if ((r = file_open(path, &f)) < 0) {
 		if (debug)
 			cprintf("file_open failed: %e", r);
-		goto out;
+		return r;
 	}
 
 	// Save the file pointer
@@ -118,9 +151,53 @@ serve_open(envid_t envid, struct Fsreq_open *rq)
 	// Fill out the Fd structure
 	o->o_fd->fd_file.file = *f;
 	o->o_fd->fd_file.id = o->o_fileid;
-	o->o_fd->fd_omode = rq->req_omode;
+	o->o_fd->fd_omode = omode;
 	o->o_fd->fd_dev_id = devfile.dev_id;
-	o->o_mode = rq->req_omode;
+	o->o_mode = omode;
+
+	*po = o;
+	return fileid;
+}
+
+// Find the block of open file 'o' containing 'offset', allocating it
+// if necessary.  Set *blk to the block and *perm to the permissions it
+// should be mapped with in the client: read-only unless the file's
+// open mode (o->o_mode) allows writes (see the O_ flags in inc/lib.h).
+// Returns 0 on success, < 0 on error.
+static int
+openfile_get_block(struct OpenFile *o, off_t offset, char **blk, int *perm)
+{
+	int r;
+
+	if ((r = file_get_block(o->o_file, offset / BLKSIZE, blk)) < 0)
+		return r;
+
+	if ((O_ACCMODE & o->o_mode) == O_RDONLY)
+		*perm = PTE_U | PTE_P;
+	else
+		*perm = PTE_U | PTE_P | PTE_W;
+	return 0;
+}
+
+// Serve requests, sending responses back to envid.
+// To send a result back, ipc_send(envid, r, 0, 0).
+// To include a page, ipc_send(envid, r, srcva, perm).
+void
+serve_open(envid_t envid, struct Fsreq_open *rq)
+{
+	char path[MAXPATHLEN];
+	int r;
+	struct OpenFile *o;
+
+	if (debug)
+		cprintf("serve_open %08x %s 0x%x\n", envid, rq->req_path, rq->req_omode);
+
+	// Copy in the path, making sure it's null-terminated
+	memmove(path, rq->req_path, MAXPATHLEN);
+	path[MAXPATHLEN-1] = 0;
+
+	if ((r = openfile_open(path, rq->req_omode, &o)) < 0)
+		goto out;
 
 	if (debug)
 		cprintf("sending success, page %08x\n", (uintptr_t) o->o_fd);
@@ -196,29 +273,20 @@ serve_map(envid_t envid, struct Fsreq_map *rq)
 	char *blk;
 	struct OpenFile *o;
 	int perm;
-	uint32_t filebno;
 
 	if (debug)
 		cprintf("serve_map %08x %08x %08x\n", envid, rq->req_fileid, rq->req_offset);
 
 	// Map the requested block in the client's address space
 	// by using ipc_send.
-	// Map read-only unless the file's open mode (o->o_mode) allows writes
-	// (see the O_ flags in inc/lib.h).
 	
 	// LAB 5: Your code here.
 	if ((r = openfile_lookup(envid, rq->req_fileid, &o)) < 0)
 		goto out;
 	
-	filebno = rq->req_offset / BLKSIZE;
-	if ((r = file_get_block(o->o_file, filebno, &blk)) < 0)
+	if ((r = openfile_get_block(o, rq->req_offset, &blk, &perm)) < 0)
 		goto out;
 
-	if ((O_ACCMODE & o->o_mode) == O_RDONLY)
-		perm = PTE_U | PTE_P;
-	else
-		perm = PTE_U | PTE_P | PTE_W;
-
 	ipc_send(envid, r, blk, perm);
 	return;
 out:
@@ -287,6 +355,84 @@ out:
 	ipc_send(envid, r, 0, 0);
 }
 
+void
+serve_stat(envid_t envid, struct Fsreq_stat *rq)
+{
+	char path[MAXPATHLEN];
+	struct File *f;
+	int r;
+
+	if (debug)
+		cprintf("serve_stat %08x %s\n", envid, rq->req_path);
+
+	// Copy in the path, making sure it's null-terminated
+	memmove(path, rq->req_path, MAXPATHLEN);
+	path[MAXPATHLEN-1] = 0;
+
+	if ((r = file_open(path, &f)) < 0)
+		goto out;
+
+	strcpy(rq->ret_name, f->f_name);
+	rq->ret_size = f->f_size;
+	rq->ret_isdir = (f->f_type == FTYPE_DIR);
+out:
+	ipc_send(envid, r, 0, 0);
+}
+
+void
+serve_readdir(envid_t envid, struct Fsreq_readdir *rq)
+{
+	char path[MAXPATHLEN];
+	struct File *dir, *f;
+	struct Fsdirent *d;
+	uint32_t pos, nslot, len, reclen;
+	char *blk;
+	int r;
+
+	if (debug)
+		cprintf("serve_readdir %08x %s %d\n", envid, rq->req_path, rq->req_pos);
+
+	// Copy in the path, making sure it's null-terminated
+	memmove(path, rq->req_path, MAXPATHLEN);
+	path[MAXPATHLEN-1] = 0;
+
+	if ((r = file_open(path, &dir)) < 0)
+		goto out;
+	if (dir->f_type != FTYPE_DIR) {
+		r = -E_INVAL;
+		goto out;
+	}
+
+	len = 0;
+	nslot = dir->f_size / BLKSIZE * BLKFILES;
+	for (pos = rq->req_pos; pos < nslot; pos++) {
+		if ((r = file_get_block(dir, pos / BLKFILES, &blk)) < 0)
+			goto out;
+		f = &((struct File*) blk)[pos % BLKFILES];
+		if (f->f_name[0] == '\0')
+			continue;
+		reclen = FSDIRENT_RECLEN(strlen(f->f_name));
+		if (len + reclen > MIN(rq->req_len, sizeof(rq->ret_buf)))
+			break;
+		d = (struct Fsdirent*) &rq->ret_buf[len];
+		d->d_size = f->f_size;
+		d->d_type = f->f_type;
+		d->d_reclen = reclen;
+		strcpy(d->d_name, f->f_name);
+		len += reclen;
+	}
+
+	// Don't report the end of the directory if an entry didn't fit.
+	if (len == 0 && pos < nslot) {
+		r = -E_INVAL;
+		goto out;
+	}
+	rq->ret_pos = pos;
+	r = len;
+out:
+	ipc_send(envid, r, 0, 0);
+}
+
 void
 serve_sync(envid_t envid)
 {
@@ -294,6 +440,70 @@ serve_sync(envid_t envid)
 	ipc_send(envid, 0, 0, 0);
 }
 
+// Pages returned by a batch; too big for the stack.
+static struct IpcPage batchpg[FSBATCH_NPAGES];
+
+void
+serve_batch(envid_t envid, struct Fsreq_batch *rq)
+{
+	struct Fsreq_batchent *be;
+	struct OpenFile *o;
+	int i, j, n, r, npg, perm;
+	char *blk;
+
+	if (debug)
+		cprintf("serve_batch %08x %d\n", envid, rq->req_n);
+
+	npg = 0;
+	n = MIN(MAX(rq->req_n, 0), FSBATCH_NENT);
+	for (r = 0, i = 0; r == 0 && i < n; i++) {
+		be = &rq->req_ent[i];
+		if ((r = openfile_lookup(envid, be->be_fileid, &o)) < 0)
+			continue;
+
+		switch (be->be_type) {
+		case FSREQ_MAP:
+			for (j = 0; j < be->be_npages; j++) {
+				if (be->be_offset + j * BLKSIZE >= o->o_file->f_size)
+					break;
+				if (npg == FSBATCH_NPAGES) {
+					r = -E_INVAL;
+					break;
+				}
+				if ((r = openfile_get_block(o, be->be_offset + j * BLKSIZE,
+							    &blk, &perm)) < 0)
+					break;
+				batchpg[npg].ip_srcva = blk;
+				batchpg[npg].ip_dstpg = be->be_dstpg + j;
+				batchpg[npg].ip_perm = perm;
+				npg++;
+			}
+			be->be_r = j;
+			break;
+		case FSREQ_SET_SIZE:
+			if ((r = file_set_size(o->o_file, be->be_offset)) == 0)
+				o->o_fd->fd_file.file.f_size = be->be_offset;
+			be->be_r = r;
+			break;
+		case FSREQ_DIRTY:
+			r = be->be_r = file_dirty(o->o_file, be->be_offset);
+			break;
+		case FSREQ_CLOSE:
+			file_close(o->o_file);
+			be->be_r = 0;
+			break;
+		default:
+			r = -E_INVAL;
+			break;
+		}
+	}
+
+	// The loop has stepped past the request that failed.
+	if (r < 0)
+		rq->req_ent[i - 1].be_r = r;
+	ipc_send_pages(envid, r, batchpg, npg);
+}
+
 void
 serve(void)
 {
@@ -336,6 +546,15 @@ serve(void)
 		case FSREQ_SYNC:
 			serve_sync(whom);
 			break;
+		case FSREQ_BATCH:
+			serve_batch(whom, (struct Fsreq_batch*)REQVA);
+			break;
+		case FSREQ_STAT:
+			serve_stat(whom, (struct Fsreq_stat*)REQVA);
+			break;
+		case FSREQ_READDIR:
+			serve_readdir(whom, (struct Fsreq_readdir*)REQVA);
+			break;
 		default:
 			cprintf("Invalid request code %d from %08x\n", whom, req);
 			break;
@@ -35,6 +35,49 @@ typedef int32_t envid_t;
 #define ENV_RUNNABLE		1
 #define ENV_NOT_RUNNABLE	2
 
+// Data about an environment that the kernel maps read-only at UVSYS
+// in that environment, so it can be read without a system call.
+struct Vsys {
+	envid_t vs_envid;		// this environment's envid
+	envid_t vs_parent_id;		// env_id of its parent
+	uint32_t vs_runs;		// times it has been scheduled
+	uint32_t vs_ticks;		// timer ticks that interrupted it
+	uint32_t vs_flags;		// VSYS_ flags
+};
+
+// Values of vs_flags
+#define VSYS_SYSENTER	0x1		// system calls may use sysenter
+
+// CPU accounting for an environment, read with sys_env_stats.
+struct EnvStats {
+	uint64_t es_user_cycles;	// TSC cycles spent in user mode
+	uint64_t es_kern_cycles;	// and in the kernel on its behalf
+	uint32_t es_syscalls;		// system calls made
+	uint32_t es_pgfaults;		// page faults taken
+};
+
+// Hardware performance counter totals for an environment, counted
+// while it runs in user mode, read with sys_env_perf.
+enum {
+	PERF_CYCLES = 0,		// unhalted core cycles
+	PERF_INSTRS,			// instructions retired
+	PERF_LLC_MISSES,		// last level cache misses
+	PERF_DTLB_MISSES,		// data TLB misses
+	PERF_NEVENT
+};
+
+struct EnvPerf {
+	uint64_t ep_count[PERF_NEVENT];
+};
+
+// A kernel timer belonging to an environment (see kern/time.c).
+struct EnvTimer {
+	uint32_t et_deadline;		// time_msec() at which it fires
+	int et_heapidx;			// index in the timer heap; -1 if idle
+	uint32_t et_value;		// value delivered by sys_timer_set
+	bool et_fired;			// notification awaiting sys_ipc_recv
+};
+
 struct Env {
 	struct Trapframe env_tf;	// Saved registers
 	LIST_ENTRY(Env) env_link;	// Free list link pointers
@@ -42,10 +85,14 @@ struct Env {
 	envid_t env_parent_id;		// env_id of this env's parent
 	unsigned env_status;		// Status of the environment
 	uint32_t env_runs;		// Number of times environment has run
+	struct EnvStats env_stats;	// CPU accounting
+	struct SyscallTrace *env_sctrace; // system call trace ring, if tracing
+	struct EnvPerf env_perf;	// performance counter totals
 
 	// Address space
 	pde_t *env_pgdir;		// Kernel virtual address of page dir
 	physaddr_t env_cr3;		// Physical address of page dir
+	struct Vsys *env_vsys;		// Kernel virtual address of UVSYS page
 
 	// Exception handling
 	void *env_pgfault_upcall;	// page fault upcall entry point
@@ -53,9 +100,23 @@ struct Env {
 	// Lab 4 IPC
 	bool env_ipc_recving;		// env is blocked receiving
 	void *env_ipc_dstva;		// va at which to map received page
+	uint32_t env_ipc_dstnpg;	// number of pages at env_ipc_dstva
 	uint32_t env_ipc_value;		// data value sent to us 
 	envid_t env_ipc_from;		// envid of the sender	
 	int env_ipc_perm;		// perm of page mapping received
+
+	// Timers
+	struct EnvTimer env_timer;	// set by sys_timer_set
+	struct EnvTimer env_ipc_timeout; // deadline of sys_ipc_recv_timeout
+};
+
+// One page of a multi-page IPC (sys_ipc_try_send_pages): the page
+// mapped at ip_srcva in the sender is mapped ip_dstpg pages into the
+// receiver's receive area, with permission ip_perm.
+struct IpcPage {
+	void *ip_srcva;
+	uint32_t ip_dstpg;
+	int ip_perm;
 };
 
 #endif // !JOS_INC_ENV_H
@@ -24,6 +24,10 @@
 #define E_FILE_EXISTS	13	// File already exists
 #define E_NOT_EXEC	14	// File not a valid executable
 
-#define MAXERROR	14
+#define E_TX_FULL	15	// NIC transmit ring is full
+
+#define E_TIMEOUT	16	// Deadline passed before an IPC arrived
+
+#define MAXERROR	16
 
 #endif	// !JOS_INC_ERROR_H */
@@ -48,6 +48,9 @@ struct Stat {
 
 char*	fd2data(struct Fd *fd);
 int	fd2num(struct Fd *fd);
+int	data2fd(void *va, struct Fd **fd_store);
+off_t	fd2window(struct Fd *fd);
+void	fd_set_window(struct Fd *fd, off_t offset);
 int	fd_alloc(struct Fd **fd_store);
 int	fd_close(struct Fd *fd, bool must_exist);
 int	fd_lookup(int fdnum, struct Fd **fd_store);
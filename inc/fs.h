@@ -22,8 +22,13 @@
 #define NDIRECT		10
 // Number of direct block pointers in an indirect block
 #define NINDIRECT	(BLKSIZE / 4)
+// Number of blocks reachable through the double-indirect block
+#define NDINDIRECT	(NINDIRECT * NINDIRECT)
 
-#define MAXFILESIZE	(NINDIRECT * BLKSIZE)
+// Largest file size we allow.  The block pointers could address
+// (NINDIRECT + NDINDIRECT) blocks, a little over 4GB, but file sizes and
+// offsets must stay comfortably inside an off_t.
+#define MAXFILESIZE	0x40000000
 
 struct File {
 	char f_name[MAXNAMELEN];	// filename
@@ -34,6 +39,7 @@ struct File {
 	// A block is allocated iff its value is != 0.
 	uint32_t f_direct[NDIRECT];	// direct blocks
 	uint32_t f_indirect;		// indirect block
+	uint32_t f_dindirect;		// double-indirect block
 
 	// Points to the directory in which this file lives.
 	// Meaningful only in memory; the value on disk can be garbage.
@@ -42,7 +48,7 @@ struct File {
 
 	// Pad out to 256 bytes; must do arithmetic in case we're compiling
 	// fsformat on a 64-bit machine.
-	uint8_t f_pad[256 - MAXNAMELEN - 8 - 4*NDIRECT - 4 - sizeof(struct File*)];
+	uint8_t f_pad[256 - MAXNAMELEN - 8 - 4*NDIRECT - 8 - sizeof(struct File*)];
 } __attribute__((packed));	// required only on some 64-bit machines
 
 // An inode block contains exactly BLKFILES 'struct File's
@@ -72,6 +78,9 @@ struct Super {
 #define FSREQ_DIRTY	5
 #define FSREQ_REMOVE	6
 #define FSREQ_SYNC	7
+#define FSREQ_BATCH	8
+#define FSREQ_STAT	9
+#define FSREQ_READDIR	10
 
 struct Fsreq_open {
 	char req_path[MAXPATHLEN];
@@ -101,4 +110,67 @@ struct Fsreq_remove {
 	char req_path[MAXPATHLEN];
 };
 
+struct Fsreq_stat {
+	char req_path[MAXPATHLEN];
+	// Filled in by the server
+	char ret_name[MAXNAMELEN];
+	off_t ret_size;
+	int ret_isdir;
+};
+
+// FSREQ_READDIR packs the entries of the directory req_path, starting at
+// slot req_pos, into ret_buf as a sequence of 'struct Fsdirent's, until
+// req_len bytes are used up.  The reply value is the number of bytes
+// used, 0 at the end of the directory.  ret_pos is the slot to continue
+// from.
+struct Fsreq_readdir {
+	char req_path[MAXPATHLEN];
+	uint32_t req_pos;
+	uint32_t req_len;
+	// Filled in by the server
+	uint32_t ret_pos;
+	uint8_t ret_buf[2048];
+};
+
+// A directory entry as returned by FSREQ_READDIR.
+// Only the first d_reclen bytes of each entry are present.
+struct Fsdirent {
+	off_t d_size;		// file size in bytes
+	uint8_t d_type;		// file type
+	uint8_t d_reclen;	// length of this entry
+	char d_name[MAXNAMELEN];	// null-terminated name
+};
+
+#define FSDIRENT_RECLEN(namelen) \
+	ROUNDUP(offsetof(struct Fsdirent, d_name) + (namelen) + 1, 4)
+#define FSDIRENT_NEXT(d) \
+	((struct Fsdirent *) ((char *) (d) + (d)->d_reclen))
+
+// FSREQ_BATCH carries up to FSBATCH_NENT MAP, SET_SIZE, DIRTY and CLOSE
+// requests, which the server executes in order, stopping at the first
+// one that fails.  The reply value is that request's error, or 0.
+// Each request's result comes back in its be_r: the number of pages
+// mapped for MAP, 0 for the others.
+//
+// MAP maps the pages of [be_offset, be_offset + be_npages*BLKSIZE) that
+// lie below the file's size.  They are mapped into the area the client
+// receives pages in (see ipc_recv_pages), starting be_dstpg pages into
+// it; at most FSBATCH_NPAGES pages are returned in all.
+#define FSBATCH_NENT	32
+#define FSBATCH_NPAGES	(PTSIZE / BLKSIZE)
+
+struct Fsreq_batchent {
+	int be_type;		// FSREQ_MAP, SET_SIZE, DIRTY or CLOSE
+	int be_fileid;		// file ID
+	off_t be_offset;	// MAP, DIRTY: file offset; SET_SIZE: new size
+	int be_npages;		// MAP: number of pages
+	uint32_t be_dstpg;	// MAP: page offset in the receive area
+	int be_r;		// result, filled in by the server
+};
+
+struct Fsreq_batch {
+	int req_n;
+	struct Fsreq_batchent req_ent[FSBATCH_NENT];
+};
+
 #endif /* !JOS_INC_FS_H */
@@ -22,6 +22,7 @@
 #include <inc/args.h>
 #include <inc/malloc.h>
 #include <inc/ns.h>
+#include <inc/time.h>
 
 #define USED(x)		(void)(x)
 
@@ -30,9 +31,12 @@ extern char *binaryname;
 extern volatile struct Env *env;
 extern volatile struct Env envs[NENV];
 extern volatile struct Page pages[];
+extern volatile struct TimePage timepage;
+extern volatile struct Vsys vsys;
 void	exit(void);
 
 // pgfault.c
+void	pgfault_init(void);
 void	set_pgfault_handler(void (*handler)(struct UTrapframe *utf));
 
 // readline.c
@@ -53,10 +57,23 @@ int	sys_page_map(envid_t src_env, void *src_pg,
 		     envid_t dst_env, void *dst_pg, int perm);
 int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
+int	sys_ipc_try_send_pages(envid_t to_env, uint32_t value,
+			       struct IpcPage *pgs, size_t n);
 int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_recv_pages(void *rcv_pg, size_t npages);
 unsigned int sys_time_msec(void);
 int	sys_transmit_packet(void *pkt_data, uint32_t datalen);
 int	sys_receive_packet(void *va);
+int	sys_receive_wait(void);
+int	sys_transmit_wait(void);
+int	sys_receive_pages(void *va, uint32_t n);
+int	sys_transmit_packets(const struct TxPkt *pkts, uint32_t n);
+int	sys_ipc_recv_timeout(void *rcv_pg, size_t npages, unsigned int deadline);
+int	sys_timer_set(envid_t env, unsigned int deadline, uint32_t value);
+unsigned int sys_time_usec(void);
+uint64_t sys_time_nsec(void);
+int	sys_env_stats(envid_t env, struct EnvStats *stats);
+int	sys_env_perf(envid_t env, struct EnvPerf *perf);
 
 // This must be inlined.  Exercise for reader: why?
 static __inline envid_t sys_exofork(void) __attribute__((always_inline));
@@ -74,7 +91,17 @@ sys_exofork(void)
 
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
+void	ipc_send_pages(envid_t to_env, uint32_t value, struct IpcPage *pgs, size_t n);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int32_t ipc_recv_pages(envid_t *from_env_store, void *pg, size_t npages,
+		       int *perm_store);
+int32_t ipc_recv_timeout(envid_t *from_env_store, void *pg, size_t npages,
+			 int *perm_store, unsigned int deadline);
+
+// time.c
+unsigned int time_msec(void);
+uint64_t time_nsec(void);
+unsigned int time_usec(void);
 
 // fork.c
 #define	PTE_SHARE	0x400
@@ -98,6 +125,8 @@ int	read_map(int fd, off_t offset, void **blk);
 int	ftruncate(int fd, off_t size);
 int	remove(const char *path);
 int	sync(void);
+int	readdir(const char *path, uint32_t *pos, void *buf, size_t n);
+int	file_pgfault(struct UTrapframe *utf);
 
 // fsipc.c
 int	fsipc_open(const char *path, int omode, struct Fd *fd);
@@ -107,6 +136,9 @@ int	fsipc_close(int fileid);
 int	fsipc_dirty(int fileid, off_t offset);
 int	fsipc_remove(const char *path);
 int	fsipc_sync(void);
+int	fsipc_stat(const char *path, struct Stat *st);
+int	fsipc_readdir(const char *path, uint32_t *pos, void *buf, size_t n);
+int	fsipc_dirty_close(int fileid, const off_t *offsets, int n, bool close);
 
 // sockets.c
 int     accept(int s, struct sockaddr *addr, socklen_t *addrlen);
@@ -118,6 +150,7 @@ int     listen(int s, int backlog);
 int     recv(int s, void *mem, int len, unsigned int flags);
 int     send(int s, const void *dataptr, int size, unsigned int flags);
 int     socket(int domain, int type, int protocol);
+int     sendfile(int s, int fd, off_t offset, size_t len);
 
 // nsipc.c
 int     nsipc_accept(int s, struct sockaddr *addr, socklen_t *addrlen);
@@ -129,6 +162,8 @@ int     nsipc_listen(int s, int backlog);
 int     nsipc_recv(int s, void *mem, int len, unsigned int flags);
 int     nsipc_send(int s, const void *dataptr, int size, unsigned int flags);
 int     nsipc_socket(int domain, int type, int protocol);
+int     nsipc_sendpage(int s, const void *pg, int offset, int size,
+		       unsigned int flags);
 // pageref.c
 int	pageref(void *addr);
 
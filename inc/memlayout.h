@@ -107,6 +107,10 @@
 #define UPAGES		(UVPT - PTSIZE)
 // Read-only copies of the global env structures
 #define UENVS		(UPAGES - PTSIZE)
+// Read-only kernel clock (struct TimePage), in the last page of UENVS's area
+#define UTIME		(UPAGES - PGSIZE)
+// Read-only per-environment data (struct Vsys), just below UTIME
+#define UVSYS		(UTIME - PGSIZE)
 
 /*
  * Top of user VM. User can manipulate VA from UTOP-1 and down!
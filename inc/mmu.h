@@ -121,6 +121,21 @@
 #define FL_VIP		0x00100000	// Virtual Interrupt Pending
 #define FL_ID		0x00200000	// ID flag
 
+// Model-specific registers
+#define MSR_SYSENTER_CS		0x174	// CS for sysenter; sysexit uses CS+16
+#define MSR_SYSENTER_ESP	0x175	// ESP for sysenter
+#define MSR_SYSENTER_EIP	0x176	// EIP for sysenter
+#define MSR_PMC0		0x0c1	// first general-purpose performance counter
+#define MSR_PERFEVTSEL0		0x186	// and the register selecting its event
+#define MSR_PERF_GLOBAL_CTRL	0x38f	// counter enables, perfmon version >= 2
+
+// Values in MSR_PERFEVTSEL0 and following
+#define PERFEVTSEL_USR		0x00010000	// count in user mode
+#define PERFEVTSEL_EN		0x00400000	// enable the counter
+
+// CPUID function 1 feature flags, in EDX
+#define CPUID_FEAT_SEP		0x00000800	// sysenter/sysexit
+
 // Page fault error codes
 #define FEC_PR		0x1	// Page fault caused by protection violation
 #define FEC_WR		0x2	// Page fault caused by a write
@@ -4,6 +4,7 @@
 #define JOS_INC_NS_H
 
 #include <inc/types.h>
+#include <inc/syscall.h>
 #include <lwip/sockets.h>
 
 // Definitions for requests from clients to network server
@@ -18,12 +19,24 @@
 #define NSREQ_SEND	8
 #define NSREQ_SOCKET	9
 
-// The following two messages pass a page containing a struct jif_pkt
+// NSREQ_INPUT passes up to NSREQ_NPAGES pages, one per received frame,
+// each containing a struct jif_pkt.  The pages come straight from the
+// NIC's receive ring, and the struct jif_pkt is NSREQ_INPUT_OFFSET bytes
+// into each.
+// NSREQ_OUTPUT passes a page containing a struct jif_outreq, followed by
+// up to NSREQ_OUTPUT_NPAGES - 1 pages holding pieces of its frames.
 #define NSREQ_INPUT	10
 #define NSREQ_OUTPUT	11
 
-// The following message passes no page
-#define NSREQ_TIMER	12
+#define NSREQ_INPUT_OFFSET	12
+#define NSREQ_OUTPUT_NPAGES	32
+
+// The following message passes two pages: the request,
+// then the page holding the data to send
+#define NSREQ_SENDPAGE	13
+
+// Most pages a request to the network server passes
+#define NSREQ_NPAGES	8
 
 struct Nsreq_accept {
     int req_s;
@@ -73,6 +86,13 @@ struct Nsreq_send {
     char req_dataptr[0];
 };
 
+struct Nsreq_sendpage {
+    int req_s;
+    int req_offset;	// of the data within the data page
+    int req_size;
+    unsigned int req_flags;
+};
+
 struct Nsreq_socket {
     int req_domain;
     int req_type;
@@ -84,4 +104,27 @@ struct jif_pkt {
     char jp_data[0];
 };
 
+// Frames to send, in pieces.  Each piece is part of a page passed with
+// the request: jf_page 0 is the request page itself, whose jr_data holds
+// whatever was copied.  The frames go to sys_transmit_packets as they are.
+struct jif_frag {
+    uint16_t jf_page;
+    uint16_t jf_off;
+    uint16_t jf_len;
+};
+
+struct jif_outpkt {
+    int jo_nfrag;
+    struct jif_frag jo_frags[TXFRAG_MAX];
+};
+
+// Most frames in one NSREQ_OUTPUT
+#define JIF_OUTPKT_MAX	TXPKT_MAX
+
+struct jif_outreq {
+    int jr_npkt;
+    struct jif_outpkt jr_pkts[JIF_OUTPKT_MAX];
+    char jr_data[0];
+};
+
 #endif // !JOS_INC_NS_H
@@ -1,6 +1,8 @@
 #ifndef JOS_INC_SYSCALL_H
 #define JOS_INC_SYSCALL_H
 
+#include <inc/types.h>
+
 /* system call numbers */
 enum
 {
@@ -21,7 +23,38 @@ enum
 	SYS_time_msec,
 	SYS_transmit_packet,
 	SYS_receive_packet,
+	SYS_ipc_try_send_pages,
+	SYS_receive_wait,
+	SYS_receive_pages,
+	SYS_transmit_packets,
+	SYS_ipc_recv_timeout,
+	SYS_timer_set,
+	SYS_time_usec,
+	SYS_time_nsec,
+	SYS_env_stats,
+	SYS_env_perf,
+	SYS_transmit_wait,
 	NSYSCALLS
 };
 
+// One piece of a frame sent with sys_transmit_packets.
+// A piece may not cross a page boundary.
+struct TxFrag {
+	void *tf_va;
+	uint32_t tf_len;
+};
+
+// Most pieces in one frame
+#define TXFRAG_MAX	8
+
+// A frame sent with sys_transmit_packets: the concatenation of
+// tp_frags[0..tp_nfrag-1].
+struct TxPkt {
+	uint32_t tp_nfrag;
+	struct TxFrag tp_frags[TXFRAG_MAX];
+};
+
+// Most frames in one sys_transmit_packets
+#define TXPKT_MAX	16
+
 #endif /* !JOS_INC_SYSCALL_H */
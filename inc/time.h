@@ -0,0 +1,44 @@
+#ifndef JOS_INC_TIME_H
+#define JOS_INC_TIME_H
+
+#include <inc/types.h>
+#include <inc/x86.h>
+
+// Milliseconds between timer interrupts
+#define TICK_MSEC	10
+
+// tp_nsec_mult is nanoseconds per 2^TIME_MULT_SHIFT TSC cycles
+#define TIME_MULT_SHIFT	24
+
+// The kernel clock, updated on timer interrupts and mapped read-only
+// at UTIME in every environment.  tp_seq is odd while it is updated.
+struct TimePage {
+	volatile uint32_t tp_seq;	// update sequence number
+	uint32_t tp_msec;		// time_msec() at the last update
+	uint64_t tp_tsc;		// TSC at tp_msec
+	uint32_t tp_tsc_khz;		// TSC frequency, 0 if uncalibrated
+	uint32_t tp_nsec_mult;		// TSC cycles to nanoseconds
+};
+
+// Return nanoseconds since boot: the time of the last clock update
+// plus the TSC cycles since then.
+static __inline uint64_t
+timepage_nsec(const volatile struct TimePage *tp)
+{
+	uint32_t seq, msec, mult;
+	uint64_t tsc, delta, nsec;
+
+	do {
+		seq = tp->tp_seq;
+		msec = tp->tp_msec;
+		tsc = tp->tp_tsc;
+		mult = tp->tp_nsec_mult;
+	} while ((seq & 1) || seq != tp->tp_seq);
+
+	delta = read_tsc() - tsc;
+	nsec = (((uint64_t) (uint32_t) delta * mult) >> TIME_MULT_SHIFT)
+		+ (((delta >> 32) * mult) << (32 - TIME_MULT_SHIFT));
+	return (uint64_t) msec * 1000000 + nsec;
+}
+
+#endif	// !JOS_INC_TIME_H
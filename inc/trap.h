@@ -33,6 +33,7 @@
 // IRQ_OFFSET is defined in kern/picirq.h = 32
 #define IRQ_TIMER        0
 #define IRQ_KBD          1
+#define IRQ_SERIAL       4
 #define IRQ_SPURIOUS     7
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
@@ -37,6 +37,9 @@ static __inline uint32_t read_arg(int, uint32_t) __attribute__((always_inline));
 static __inline uint32_t read_pre_ebp(uint32_t) __attribute__((always_inline));
 static __inline void cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp);
 static __inline uint64_t read_tsc(void) __attribute__((always_inline));
+static __inline uint64_t rdmsr(uint32_t msr) __attribute__((always_inline));
+static __inline void wrmsr(uint32_t msr, uint64_t val) __attribute__((always_inline));
+static __inline uint64_t rdpmc(uint32_t ctr) __attribute__((always_inline));
 
 static __inline void
 breakpoint(void)
@@ -277,6 +280,28 @@ read_tsc(void)
         return tsc;
 }
 
+static __inline uint64_t
+rdmsr(uint32_t msr)
+{
+	uint64_t val;
+	__asm __volatile("rdmsr" : "=A" (val) : "c" (msr));
+	return val;
+}
+
+static __inline void
+wrmsr(uint32_t msr, uint64_t val)
+{
+	__asm __volatile("wrmsr" : : "c" (msr), "A" (val));
+}
+
+static __inline uint64_t
+rdpmc(uint32_t ctr)
+{
+	uint64_t val;
+	__asm __volatile("rdpmc" : "=A" (val) : "c" (ctr));
+	return val;
+}
+
 //return args pushed by the caller
 static __inline uint32_t
 read_arg(int num, uint32_t baseptr)
@@ -2,97 +2,252 @@
 #include <kern/e100.h>
 #include <kern/pci.h>
 #include <kern/pmap.h>
+#include <kern/env.h>
+#include <kern/picirq.h>
 
 #include <inc/stdio.h>
 #include <inc/x86.h>
 #include <inc/types.h>
 #include <inc/string.h>
-
-#define TCB_COUNT 16
-#define RFD_COUNT 16
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/ns.h>
 
 uint32_t csr_port;
 
-void *cu_base;
-void *ru_base;
+struct e100_stats e100_stats;
+
+// The transmit ring: one page per TCB.  A frame is either copied into
+// its TCB, or described by TBDs in the TCB's page pointing at the pages
+// holding it, which the ring holds references to in tx_held.
+// Slots tx_dirty up to tx_next hold frames not yet reclaimed.
+static struct Page **tx_pages;
+static int tx_count;
+static int tx_next;	// slot for the next frame to transmit
+static int tx_dirty;	// oldest slot not reclaimed yet
+
+// The receive ring: one page per RFD, so that a received frame can be
+// handed to an environment by mapping its page instead of copying it.
+static struct Page **rx_pages;
+static int rx_count;
+static int rx_next;	// slot of the next frame to hand out
+
+// Interrupt mask bits sent with every SCB command.
+// Only the frame-received, command-completed and CU-not-active
+// interrupts are enabled.
+static uint16_t scb_intmask = SCBINT_RNR | SCBINT_ER | SCBINT_FCP;
+
+// The environments blocked in nic_e100_recv_wait and
+// nic_e100_trans_wait, if any
+static envid_t rx_waiter;
+static envid_t tx_waiter;
+
+#if E100_TRACE
+// The trace ring: the last E100_TRACE_SIZE events recorded
+static struct e100_trace_rec trace_ring[E100_TRACE_SIZE];
+static uint32_t trace_next;	// events recorded so far
+
+static const char * const trace_names[] = {
+	[E100_EV_TX]		= "tx",
+	[E100_EV_TX_DONE]	= "tx done",
+	[E100_EV_TX_ERR]	= "tx error",
+	[E100_EV_TX_FULL]	= "tx ring full",
+	[E100_EV_CU_START]	= "cu start",
+	[E100_EV_CU_RESUME]	= "cu resume",
+	[E100_EV_RX]		= "rx",
+	[E100_EV_RX_ERR]	= "rx error",
+	[E100_EV_RX_NORES]	= "rx out of rfds",
+	[E100_EV_RU_START]	= "ru start",
+	[E100_EV_INTR]		= "intr",
+};
+
+// Record an event in the trace ring.  The kernel runs with interrupts
+// disabled, so this needs no lock.
+static void
+trace(int event, int slot, uint32_t arg)
+{
+	struct e100_trace_rec *tr;
+
+	tr = &trace_ring[trace_next++ % E100_TRACE_SIZE];
+	tr->tr_tsc = read_tsc();
+	tr->tr_event = event;
+	tr->tr_slot = slot;
+	tr->tr_arg = arg;
+}
+
+#define TRACE(level, event, slot, arg)				\
+	do {							\
+		if (E100_TRACE >= (level))			\
+			trace((event), (slot), (arg));		\
+	} while (0)
+#else
+#define TRACE(level, event, slot, arg)	do { } while (0)
+#endif
+
+// Issue an SCB command, keeping the interrupt mask
+static void
+scb_command(uint16_t cmd)
+{
+	outw(csr_port + 0x2, cmd | scb_intmask);
+}
 
-struct tcb *cu_ptr; // pointer where to put the next transmit packet
-struct rfd *ru_ptr;
+// Allocate a page holding an array of 'n' page pointers,
+// and a zeroed page for each of them.
+// On error, frees whatever it allocated.
+static int
+ring_alloc(struct Page ***ring, int n)
+{
+	int i, r;
+	struct Page *pp;
+
+	if (n < 2 || n > E100_RING_MAX)
+		return -E_INVAL;
+	if ((r = page_alloc(&pp)) < 0)
+		return r;
+	pp->pp_ref++;
+	*ring = (struct Page **) page2kva(pp);
+
+	for (i = 0; i < n; i++) {
+		if ((r = page_alloc(&pp)) < 0) {
+			while (--i >= 0)
+				page_decref((*ring)[i]);
+			page_decref(pa2page(PADDR(*ring)));
+			*ring = 0;
+			return r;
+		}
+		pp->pp_ref++;
+		memset(page2kva(pp), 0, PGSIZE);
+		(*ring)[i] = pp;
+	}
+	return 0;
+}
 
-static struct rfd *pre_ru_ptr;
+// Returns the TCB in transmit ring slot i
+static struct tcb *
+tx_tcb(int i)
+{
+	return (struct tcb *) page2kva(tx_pages[i]);
+}
 
-int debug = 1;
+// Returns the pages the frame in transmit ring slot i refers to.
+// The NIC never looks at the end of a TCB's page, so they are kept there.
+static struct Page **
+tx_held(int i)
+{
+	return (struct Page **) ((char *) tx_tcb(i) + PGSIZE) - TXFRAG_MAX;
+}
 
 static int
 nic_alloc_cbl(void)
 {
-	int i;
+	int i, r;
 	struct tcb *cb_p;
-	/* tcb_size is 1518+8+8=1534 bytes
-	 * However, because we use 32-bit machine, alignment
-	 * is required. Here we use 4 bytes alignment
-	 */
-	uint32_t tcb_size = ROUNDUP(sizeof(struct tcb), 4);
 
-	// Use the flash memory, it is 16K, the physical memory is 4K
-	cu_base = (void *)(pcircd.reg_base[2]);
+	static_assert(sizeof(struct tcb) + TXFRAG_MAX * sizeof(struct Page *)
+		      <= PGSIZE);
+	static_assert(sizeof(struct tbd) * TXFRAG_MAX <= MAX_ETH_FRAME);
 
-	// Set CU_ptr to cu_base for further transmission
-	cu_ptr = cb_p = (struct tcb *)cu_base;
+	tx_count = E100_TCB_COUNT;
+	if ((r = ring_alloc(&tx_pages, tx_count)) < 0)
+		return r;
 
 	// Construct the DMA TX Ring
-	for (i = 0; i < TCB_COUNT - 1; i ++) {
+	for (i = 0; i < tx_count; i++) {
+		cb_p = tx_tcb(i);
 		cb_p->cb.cmd = 0;
 		cb_p->cb.status = 0;
-		cb_p->cb.link = tcb_size * (i + 1);
-		cb_p++;
+		cb_p->cb.link = page2pa(tx_pages[(i + 1) % tx_count]);
+		memset(tx_held(i), 0, TXFRAG_MAX * sizeof(struct Page *));
 	}
-	// Finish the Ring
-	cb_p->cb.link = 0;
+	tx_next = tx_dirty = 0;
 	return 0;
 }
 
+// Returns the RFD in receive ring slot i
+static struct rfd *
+rx_rfd(int i)
+{
+	return (struct rfd *) page2kva(rx_pages[i]);
+}
+
+// Make the page 'pp' receive ring slot i, ready to receive a frame.
+// Slot i becomes the end of the list the RU works through: its RFD gets
+// the EL bit, which the previous slot gives up.
+static void
+rx_refill(int i, struct Page *pp)
+{
+	struct rfd *rfd_ptr, *prev;
+
+	rx_pages[i] = pp;
+	rfd_ptr = rx_rfd(i);
+	rfd_ptr->cb.cmd = TCBCMD_EL;
+	rfd_ptr->cb.status = 0;
+	rfd_ptr->cb.link = page2pa(rx_pages[(i + 1) % rx_count]);
+	rfd_ptr->reserved = 0xFFFFFFFF;
+	// Most Important: the EOF and F field must be set to 0
+	// to reuse the rfd in the rfa
+	rfd_ptr->actual_count = 0;
+	rfd_ptr->buffer_size = MAX_ETH_FRAME;
+
+	prev = rx_rfd((i + rx_count - 1) % rx_count);
+	prev->cb.link = page2pa(pp);
+	prev->cb.cmd &= ~TCBCMD_EL;
+}
+
 static int
 nic_alloc_rfa(void)
 {
-	int i;
-	struct rfd *cb_p;
-	/* rfd_size is 1518+8+8=1534 bytes
-	 * However, because we use 32-bit machine, alignment
-	 * is required. Here we use 4 bytes alignment
-	 */
-	uint32_t rfd_size = ROUNDUP(sizeof(struct rfd), 4);
-	uint32_t tcb_size = ROUNDUP(sizeof(struct tcb), 4);
-
-	// Use the flash memory, set it to the end of the area
-	// which has been taken by tcb ring
-	ru_base = (void *)(pcircd.reg_base[2] + tcb_size * TCB_COUNT);
+	int i, r;
 
-	// Set ru_ptr to ru_base for further recepted processing
-	ru_ptr = cb_p = (struct rfd *)ru_base;
+	static_assert(sizeof(struct rfd) <= PGSIZE);
+	static_assert(offsetof(struct rfd, actual_count) == RFD_PKT_OFFSET);
+	// The network server finds the frame where the ring left it
+	static_assert(RFD_PKT_OFFSET == NSREQ_INPUT_OFFSET);
 
+	rx_count = E100_RFD_COUNT;
+	if ((r = ring_alloc(&rx_pages, rx_count)) < 0)
+		return r;
 	// Construct the DMA RX Ring
-	for (i = 0; i < RFD_COUNT - 1; i ++) {
-		cb_p->cb.cmd = 0;
-		cb_p->cb.status = 0;
-		cb_p->cb.link = rfd_size * (i + 1);
-		cb_p->reserved = 0xFFFFFFFF;
-		cb_p->buffer_size = MAX_ETH_FRAME;
-		cb_p++;
+	for (i = 0; i < rx_count; i++)
+		rx_refill(i, rx_pages[i]);
+	rx_next = 0;
+	return 0;
+}
+
+// If the RU has stopped, restart it at the first RFD that has not
+// received a frame yet.  The links of RFDs the RU has already read may
+// be stale (the page in the next slot may have been replaced), so always
+// START at an explicit address rather than RESUME.
+static void
+rx_restart(void)
+{
+	int i, n;
+	uint8_t ru_status = SCBSTS_RU_MASK & inb(csr_port + 0x0);
+
+	if (ru_status == SCBSTS_RU_READY)
+		return;
+
+	for (n = 0, i = rx_next; n < rx_count; n++, i = (i + 1) % rx_count)
+		if (!(rx_rfd(i)->cb.status & CBSTS_C))
+			break;
+	if (n == rx_count)
+		return;		// ring is full; restarted when a slot is freed
+
+	// The RU ran out of RFDs, and dropped whatever arrived since
+	if (ru_status == SCBSTS_RU_NORES) {
+		e100_stats.rx_nores++;
+		TRACE(1, E100_EV_RX_NORES, i, 0);
 	}
-	// Finish the Ring
-	cb_p->cb.link = 0;
-	cb_p->cb.cmd |= TCBCMD_EL;
-	
-	pre_ru_ptr = cb_p;
 
-	return 0;
+	outl(csr_port + 0x4, page2pa(rx_pages[i]));
+	TRACE(2, E100_EV_RU_START, i, 0);
+	scb_command(SCBCMD_RU_START);
 }
 
 int
 nic_e100_enable(struct pci_func *pcif)
 {
-	int i;
+	int i, r;
 
 	pci_func_enable(pcif);
 
@@ -114,205 +269,452 @@ nic_e100_enable(struct pci_func *pcif)
 	outl(csr_port + 0x8, 0x0);
 
 	// Alloc the TCB Ring
-	nic_alloc_cbl();
+	if ((r = nic_alloc_cbl()) < 0)
+		return r;
 
 	// Load CU base
+	// TCB links and TBD addresses are physical addresses, so the base is 0
 	// First write the General Pointer field in SCB
-	outl(csr_port + 0x4, PADDR((uint32_t)cu_base));
+	outl(csr_port + 0x4, 0);
 	// Second, write the SCB command to load the pointer
-	outw(csr_port + 0x2, SCBCMD_CU_LOAD_BASE);
+	scb_command(SCBCMD_CU_LOAD_BASE);
 	
 	// Alloc the RFA
-	nic_alloc_rfa();
+	if ((r = nic_alloc_rfa()) < 0)
+		return r;
 
-	if (debug)
-		cprintf("DBG: ru_base = %x, irq_line = %d\n", ru_base, pcircd.irq_line);
+	cprintf("e100: irq %d, %d TCBs, %d RFDs\n",
+		pcircd.irq_line, tx_count, rx_count);
 	// Load RU base
-	// First write the General Pointer field in SCB
-	outl(csr_port + 0x4, PADDR((uint32_t)ru_base));
-	// Second, write the SCB command to load the pointer
-	outw(csr_port + 0x2, SCBCMD_RU_LOAD_BASE);
+	// RFD links are physical addresses, so the base is 0
+	outl(csr_port + 0x4, 0);
+	scb_command(SCBCMD_RU_LOAD_BASE);
 
 	// Start RU, start receiving packets
-	// FIXME: Why I cannot use RU_START?
-	outw(csr_port + 0x2, SCBCMD_RU_RESUME);
-	
+	rx_restart();
+
+	// Receive frame-received interrupts
+	irq_setmask_8259A(irq_mask_8259A & ~(1 << pcircd.irq_line));
+
 	return 0;
 }
 
-// Before we transmit a packet, we first reclaim any buffers which 
-// have been marked as transmitted by the E100. But we do not actually
-// reclaim it, just make a mark since what we use is a ring buffer
+// Reclaim the slots of frames the E100 has finished transmitting,
+// releasing the pages they referred to.  The CU sends frames in order,
+// so stop at the first one it hasn't finished.
 static void
-tx_reclaim_transmited_buffers(struct tcb *tcb_ptr)
+tx_reclaim(void)
 {
-	int i;
-	for (i = 0; i < TCB_COUNT; i ++, tcb_ptr = (cu_base + tcb_ptr->cb.link)) {
-		if ((tcb_ptr->cb.status & CBSTS_C) && (tcb_ptr->cb.status & CBSTS_OK)) {
-			// Completed Successful
-
-			// Clear the bit
-			tcb_ptr->cb.status = 0;
-			tcb_ptr->cb.cmd = 0;
-	 	} else if((tcb_ptr->cb.status & CBSTS_C) && !(tcb_ptr->cb.status & CBSTS_OK)) {
+	int j;
+	struct tcb *tcb_ptr;
+	struct Page **held;
+
+	for (; e100_stats.tx_used > 0; tx_dirty = (tx_dirty + 1) % tx_count) {
+		tcb_ptr = tx_tcb(tx_dirty);
+		if (!(tcb_ptr->cb.status & CBSTS_C))
+			break;
+		if (!(tcb_ptr->cb.status & CBSTS_OK)) {
 			// Error Occured, just reuse this block
-			cprintf("One Frame Transmit Error! : %d\n", i);
-			tcb_ptr->cb.status = 0;
-			tcb_ptr->cb.cmd = 0;
+			TRACE(1, E100_EV_TX_ERR, tx_dirty, tcb_ptr->cb.status);
+			e100_stats.tx_errors++;
+		} else
+			TRACE(2, E100_EV_TX_DONE, tx_dirty, 0);
+		held = tx_held(tx_dirty);
+		for (j = 0; j < TXFRAG_MAX && held[j]; j++) {
+			page_decref(held[j]);
+			held[j] = 0;
 		}
+		tcb_ptr->cb.status = 0;
+		tcb_ptr->cb.cmd = 0;
+		e100_stats.tx_used--;
 	}
 }
 
-// If the tcb block can be used by the driver to transmit packet
+// Return the slot for the next frame, or -E_TX_FULL if the ring is full.
+// The caller has reclaimed finished slots.
 static int
-tcb_avail(struct tcb *tcb_ptr)
+tx_slot(void)
 {
-	return !(tcb_ptr->cb.cmd);
+	if (e100_stats.tx_used == tx_count) {
+		// There is no available slot in the DMA transmit ring
+		TRACE(1, E100_EV_TX_FULL, tx_next, 0);
+		return -E_TX_FULL;
+	}
+	return tx_next;
 }
 
+// Add the frame in slot i, which the caller has filled in, to the
+// end of the CBL.
 static void
-construct_tcb_header(struct tcb *tcb_ptr, uint16_t datalen)
+tx_queue(int i)
 {
-	tcb_ptr->cb.cmd = TCBCMD_TRANSMIT | TCBCMD_S;
-	tcb_ptr->cb.status = 0;
-	tcb_ptr->tbd_array_addr = 0xFFFFFFFF;
-	tcb_ptr->tbd_thrs = 0xE0;
-	tcb_ptr->tbd_byte_count = datalen;
+	// The CU suspends after each frame.  If it hasn't reached the end
+	// of the previous one yet, let it carry on to this one instead.
+	// It may have read the previous TCB's S bit already, though, and
+	// suspend anyway after tx_kick saw it active: then the CNA
+	// interrupt it raises on suspending kicks it again (see
+	// nic_e100_intr).
+	tx_tcb((i + tx_count - 1) % tx_count)->cb.cmd &= ~TCBCMD_S;
+
+	// Use the next slot when we transmit a packet next time
+	tx_next = (i + 1) % tx_count;
+
+	e100_stats.tx_frames++;
+	if (++e100_stats.tx_used > e100_stats.tx_max_used)
+		e100_stats.tx_max_used = e100_stats.tx_used;
+}
+
+// Get the CU going on the frames queued from slot i on.
+static void
+tx_kick(int i)
+{
+	uint8_t cu_status = SCBSTS_CU_MASK & inb(csr_port + 0x0);
 
-	if (debug)
-		cprintf("DBG: Construct a tcb header : datalen = %d, this ptr = %x, next = %x\n", 
-			tcb_ptr->tbd_byte_count, tcb_ptr, tcb_ptr->cb.link);
+	if (cu_status == SCBSTS_CU_IDLE) {
+		// Start CU if it is idle, CU is not associated with a CB in the CBL
+		TRACE(2, E100_EV_CU_START, i, 0);
+		outl(csr_port + 0x4, page2pa(tx_pages[i]));
+		scb_command(SCBCMD_CU_START);
+	} else if (cu_status == SCBSTS_CU_SUSP) {
+		// Resume CU if it is suspended, CU has read the next link in the CBL
+		TRACE(2, E100_EV_CU_RESUME, i, 0);
+		scb_command(SCBCMD_CU_RESUME);
+	}
+	// else, CU is working, we leave her alone =)
 }
 
 int
 nic_e100_trans_pkt(void *pkt_data, uint32_t datalen)
 {
-	if (debug)
-		cprintf("DBG: Transmit a packet, datalen = %d\n", datalen);
-
-	// First, reclaim any buffer that is marked transmitted by E100
-	tx_reclaim_transmited_buffers(cu_ptr);
-
-	if (!tcb_avail(cu_ptr)) {
-		// There is no available slot in the DMA transmit ring
-		// Drop the packet
-	
-		if (debug)
-			cprintf("DBG: No slot in DMA ring available, Drop the packet\n");
+	int i;
+	struct tcb *tcb_ptr;
 
-		return 0;
+	tx_reclaim();
+	if ((i = tx_slot()) < 0) {
+		e100_stats.tx_full++;
+		return i;
 	}
 
-	// Put the pkt_data into the available slot
-	construct_tcb_header(cu_ptr, (uint16_t)datalen);
-	// Copy the data into the
-	memmove(cu_ptr->pkt_data, pkt_data, datalen);
-
-	uint8_t cu_status = SCBSTS_CU_MASK & inb(csr_port + 0x0);
-
-	if (cu_status == SCBSTS_CU_IDLE) {
-	// Start CU if it is idle, CU is not associated with a CB in the CBL
-	
-		if (debug)
-			cprintf("DBG: CU is Idle, Start it\n");
-
-		// Resume the CU
-		// FIXME: Cannot use CU_START command here, why?
-		outw(csr_port + 0x2, SCBCMD_CU_RESUME);
+	// Put the pkt_data into the available slot.
+	// Interrupt when done, in case nic_e100_trans_wait is waiting.
+	tcb_ptr = tx_tcb(i);
+	tcb_ptr->cb.cmd = TCBCMD_TRANSMIT | TCBCMD_I | TCBCMD_S;
+	tcb_ptr->cb.status = 0;
+	tcb_ptr->tbd_array_addr = 0xFFFFFFFF;
+	tcb_ptr->tbd_thrs = 0xE0;
+	tcb_ptr->tbd_byte_count = datalen;
+	memmove(tcb_ptr->pkt_data, pkt_data, datalen);
+	TRACE(2, E100_EV_TX, i, datalen);
 
-#if 0
-		// Start the CU
-		outw(csr_port + 0x2, SCBCMD_CU_START);
-#endif
-	} else if (cu_status == SCBSTS_CU_SUSP) {
-	// Resume CU if it is suspended, CU has read the next link in the CBL
-	
-		if (debug)
-			cprintf("DBG: CU is Suspended, Resume it\n");
+	tx_queue(i);
+	tx_kick(i);
+	return 0;
+}
 
-		// Resume the CU
-		outw(csr_port + 0x2, SCBCMD_CU_RESUME);
+// Fill in slot i to send the frame 'pkt', whose pieces are mapped in
+// 'pgdir', without copying it.  The slot's TBDs point at the pieces'
+// physical pages, which are held until the E100 has sent the frame.
+static int
+tx_fill_frags(int i, pde_t *pgdir, const struct TxPkt *pkt)
+{
+	int j, n = pkt->tp_nfrag;
+	uint32_t len = 0;
+	struct tcb *tcb_ptr;
+	struct tbd *tbd;
+	struct Page *pp, **held;
+
+	tcb_ptr = tx_tcb(i);
+	tbd = (struct tbd *) tcb_ptr->pkt_data;
+	held = tx_held(i);
+	for (j = 0; j < n; j++) {
+		if (!(pp = page_lookup(pgdir, pkt->tp_frags[j].tf_va, 0))) {
+			while (--j >= 0) {
+				page_decref(held[j]);
+				held[j] = 0;
+			}
+			return -E_INVAL;
+		}
+		pp->pp_ref++;
+		held[j] = pp;
+		tbd[j].tbd_addr = page2pa(pp) + PGOFF(pkt->tp_frags[j].tf_va);
+		tbd[j].tbd_size = pkt->tp_frags[j].tf_len;
+		len += tbd[j].tbd_size;
+		tbd[j].tbd_el = (j == n - 1);
 	}
-	// else, CU is working, we leave her alone =)
-
-	// Update cu_ptr to point to next frame, so we can use it when we transmit
-	// a packet next time
-	cu_ptr = cu_base + cu_ptr->cb.link;
 
+	// Flexible mode: no data in the TCB, n TBDs right after it.
+	// Interrupt when done, so that the pages are released promptly.
+	tcb_ptr->cb.cmd = TCBCMD_TRANSMIT | TCBCMD_SF | TCBCMD_I | TCBCMD_S;
+	tcb_ptr->cb.status = 0;
+	tcb_ptr->tbd_array_addr = page2pa(tx_pages[i]) + offsetof(struct tcb, pkt_data);
+	tcb_ptr->tbd_thrs = 0xE0 | (n << 8);
+	tcb_ptr->tbd_byte_count = 0;
+	TRACE(2, E100_EV_TX, i, len);
 	return 0;
 }
 
+// Transmit the 'n' frames described by 'pkts', whose pieces are mapped
+// in 'pgdir', filling as many ring slots as there are frames and
+// starting the CU once.  The caller has checked the frames.
+// Returns the number of frames queued, which is less than n if the ring
+// fills up, or < 0 on error:
+//	-E_TX_FULL if the ring is full, so that no frame was queued.
+int
+nic_e100_trans_pkts(pde_t *pgdir, const struct TxPkt *pkts, int n)
+{
+	int i, k, r, first = -1;
+
+	tx_reclaim();
+	for (k = 0; k < n; k++) {
+		if ((i = tx_slot()) < 0) {
+			e100_stats.tx_full++;
+			if (k == 0)
+				return i;
+			break;
+		}
+		if ((r = tx_fill_frags(i, pgdir, &pkts[k])) < 0) {
+			if (k == 0)
+				return r;
+			break;
+		}
+		tx_queue(i);
+		if (first < 0)
+			first = i;
+	}
+	if (first >= 0)
+		tx_kick(first);
+	return k;
+}
+
+// Skip over frames received with errors, recycling their RFDs.
+// Returns the slot of the next good frame, or -1 if there is none yet.
 static int
-rfd_avail(struct rfd *rfd_ptr)
+rx_frame(void)
 {
-	if ((rfd_ptr->cb.status & CBSTS_C) && (rfd_ptr->cb.status & CBSTS_OK)) {
-		// A packet is received in this buffer
-		if (debug)
-			cprintf("DBG: frame available in the rfa, wait...\n");
-		return 1;
+	struct rfd *rfd_ptr;
 
- 	} else if((rfd_ptr->cb.status & CBSTS_C) && !(rfd_ptr->cb.status & CBSTS_OK)) {
+	while ((rfd_ptr = rx_rfd(rx_next))->cb.status & CBSTS_C) {
+		if (rfd_ptr->cb.status & CBSTS_OK)
+			return rx_next;
 		// Error Occured, just reuse this block
-		if (debug)
-			cprintf("DBG: One Frame Receive Error! : \n");
-		return 1;
+		TRACE(1, E100_EV_RX_ERR, rx_next, rfd_ptr->cb.status);
+		e100_stats.rx_errors++;
+		rx_refill(rx_next, rx_pages[rx_next]);
+		rx_next = (rx_next + 1) % rx_count;
 	}
-
-	return 0;
+	return -1;
 }
 
-void
-nic_clear_rfd(struct rfd *rfd_ptr)
+// Count the received frames waiting in the ring, for the statistics.
+static void
+rx_count_used(void)
 {
-	rfd_ptr->cb.cmd = 0;
-	rfd_ptr->cb.status = 0;
-	rfd_ptr->reserved = 0xFFFFFFFF;
-	rfd_ptr->buffer_size = MAX_ETH_FRAME;
-	// Most Important: the EOF and F field must be set to 0 
-	// to reuse the rfd in the rfa
-	rfd_ptr->actual_count = 0;
-	rfd_ptr->cb.cmd |= TCBCMD_EL;
+	int i, n;
+
+	for (n = 0, i = rx_next; n < rx_count; n++, i = (i + 1) % rx_count)
+		if (!(rx_rfd(i)->cb.status & CBSTS_C))
+			break;
+	e100_stats.rx_used = n;
+	if (n > e100_stats.rx_max_used)
+		e100_stats.rx_max_used = n;
 }
 
+// Copy the next received frame to 'pkt_buf'.
+// Returns its length, or 0 if there is none.
 int
 nic_e100_recv_pkt(void *pkt_buf)
 {
-	int8_t ru_status;
+	int i;
 	int16_t pkt_actual_count;
 
-	if (!rfd_avail(ru_ptr)) {
-		// There is no available slot in the DMA rfa ring
-	
-		if (debug)
-			cprintf("DBG: No frame available in the rfa, wait...\n");
-
+	rx_count_used();
+	if ((i = rx_frame()) < 0) {
+		rx_restart();
 		return 0;
 	}
 
-	pkt_actual_count = RFD_LEN_MASK & ru_ptr->actual_count;
-	if (debug)
-		cprintf("DBG: A packet with length %d received\n", pkt_actual_count);
+	pkt_actual_count = RFD_LEN_MASK & rx_rfd(i)->actual_count;
+	TRACE(2, E100_EV_RX, i, pkt_actual_count);
+	memmove(pkt_buf, rx_rfd(i)->pkt_data, pkt_actual_count);
+	e100_stats.rx_frames++;
+
+	rx_refill(i, rx_pages[i]);
+	rx_next = (i + 1) % rx_count;
+	rx_restart();
+
+	return (int)pkt_actual_count;
+}
+
+// Map the pages holding up to 'n' received frames at 'va', va+PGSIZE,
+// ... in 'pgdir', and put fresh pages in their place in the receive ring.
+// Each frame's length replaces its RFD's actual_count, so that the page
+// holds a struct jif_pkt RFD_PKT_OFFSET bytes in.
+// Returns the number of frames mapped, 0 if there are none,
+// or < 0 on error.
+int
+nic_e100_recv_pages(pde_t *pgdir, void *va, int n)
+{
+	int i, k, r = 0;
+	int32_t len;
+	struct Page *pp, *np;
+	struct rfd *rfd_ptr;
+
+	rx_count_used();
+	for (k = 0; k < n; k++) {
+		if ((i = rx_frame()) < 0)
+			break;
+		if ((r = page_alloc(&np)) < 0)
+			break;
+
+		pp = rx_pages[i];
+		if ((r = page_insert(pgdir, pp, (char *) va + k * PGSIZE,
+				     PTE_P | PTE_U | PTE_W)) < 0) {
+			page_free(np);
+			break;
+		}
+		np->pp_ref++;
+
+		rfd_ptr = rx_rfd(i);
+		len = RFD_LEN_MASK & rfd_ptr->actual_count;
+		*(int32_t *) &rfd_ptr->actual_count = len;
+		// The whole page is handed out: don't let the environment
+		// see the ring's physical addresses or whatever the page
+		// held before it joined the ring.
+		rfd_ptr->cb.link = 0;
+		memset(rfd_ptr->pkt_data + len, 0,
+		       PGSIZE - offsetof(struct rfd, pkt_data) - len);
+		TRACE(2, E100_EV_RX, i, len);
+		rx_refill(i, np);
+		rx_next = (i + 1) % rx_count;
+		// The ring's reference goes to the environment
+		page_decref(pp);
+		e100_stats.rx_frames++;
+	}
+	rx_restart();
+
+	return k > 0 ? k : r;
+}
+
+// Block the current environment until a received frame is waiting in
+// the RFA.  Returns immediately if one already is.
+// The environment is made runnable again by nic_e100_intr.
+int
+nic_e100_recv_wait(void)
+{
+	if (rx_frame() >= 0)
+		return 0;
+	rx_waiter = curenv->env_id;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	return 0;
+}
+
+// Block the current environment until the transmit ring has a free
+// slot.  Returns immediately if it already has one.
+// Every frame's TCB interrupts when it has been sent, and
+// nic_e100_intr makes the environment runnable again.
+int
+nic_e100_trans_wait(void)
+{
+	tx_reclaim();
+	if (e100_stats.tx_used < tx_count)
+		return 0;
+	tx_waiter = curenv->env_id;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	return 0;
+}
+
+// Handle an interrupt from the NIC: acknowledge it, release the pages
+// of frames that have been sent, and wake up the environments waiting
+// for a frame or for room in the transmit ring.
+void
+nic_e100_intr(void)
+{
+	struct Env *e;
+	uint8_t ack;
+
+	ack = inb(csr_port + 0x1);
+	outb(csr_port + 0x1, ack);
+	TRACE(2, E100_EV_INTR, 0, ack);
+
+	if (ack & (SCBACK_CX | SCBACK_CNA))
+		tx_reclaim();
+	// The CU stopped with frames still queued (see tx_queue)
+	if ((ack & SCBACK_CNA) && e100_stats.tx_used > 0)
+		tx_kick(tx_dirty);
+
+	if (tx_waiter && e100_stats.tx_used < tx_count
+	    && envid2env(tx_waiter, &e, 0) == 0
+	    && e->env_status == ENV_NOT_RUNNABLE) {
+		e->env_status = ENV_RUNNABLE;
+		tx_waiter = 0;
+	}
 
-	memmove(pkt_buf, ru_ptr->pkt_data, pkt_actual_count);
+	if ((ack & SCBACK_FR) && rx_waiter
+	    && envid2env(rx_waiter, &e, 0) == 0
+	    && e->env_status == ENV_NOT_RUNNABLE) {
+		e->env_status = ENV_RUNNABLE;
+		rx_waiter = 0;
+	}
+}
 
-	nic_clear_rfd(ru_ptr);
+void
+nic_e100_print_stats(void)
+{
+	struct e100_stats *st = &e100_stats;
+
+	cprintf("tx: %u frames, %u errors, ring full %u times\n",
+		st->tx_frames, st->tx_errors, st->tx_full);
+	cprintf("    %u of %d TCBs in use, at most %u\n",
+		st->tx_used, tx_count, st->tx_max_used);
+	cprintf("rx: %u frames, %u errors, out of RFDs %u times\n",
+		st->rx_frames, st->rx_errors, st->rx_nores);
+	cprintf("    %u of %d RFDs waiting, at most %u\n",
+		st->rx_used, rx_count, st->rx_max_used);
+}
 
-	// Mark the previous RU as not suspend after packets received
-	pre_ru_ptr->cb.cmd &= ~TCBCMD_EL;
-	// Record the previous ru we write to clear
-	pre_ru_ptr = ru_ptr;
-	// Update ru_ptr to point to next frame, so we can use it when we receive next pkt.
-	ru_ptr = ru_base + ru_ptr->cb.link;
+// Zero the counters, keeping the current ring occupancy.
+void
+nic_e100_reset_stats(void)
+{
+	uint32_t tx_used = e100_stats.tx_used;
 
-	ru_status = SCBSTS_RU_MASK & inb(csr_port + 0x0);
+	memset(&e100_stats, 0, sizeof(e100_stats));
+	e100_stats.tx_used = tx_used;
+}
 
-	if (ru_status == SCBSTS_RU_SUSP) {
-		// Resume RU, start receiving packets
-		outw(csr_port + 0x2, SCBCMD_RU_RESUME);
-	} else if (ru_status == SCBSTS_RU_IDLE) {
-		outw(csr_port + 0x2, SCBCMD_RU_RESUME);
+// Print the last 'n' events in the trace ring, oldest first, with the
+// TSC cycles since the event before.
+void
+nic_e100_print_trace(int n)
+{
+#if E100_TRACE
+	uint32_t i;
+	struct e100_trace_rec *tr;
+	uint64_t prev = 0;
+
+	if (n > E100_TRACE_SIZE)
+		n = E100_TRACE_SIZE;
+	if (n > trace_next)
+		n = trace_next;
+	for (i = trace_next - n; i != trace_next; i++) {
+		tr = &trace_ring[i % E100_TRACE_SIZE];
+		cprintf("%6u +%10u  %-14s slot %3d  %u\n", i,
+			prev ? (uint32_t) (tr->tr_tsc - prev) : 0,
+			tr->tr_event < sizeof(trace_names) / sizeof(trace_names[0])
+			&& trace_names[tr->tr_event]
+			? trace_names[tr->tr_event] : "?",
+			tr->tr_slot, tr->tr_arg);
+		prev = tr->tr_tsc;
 	}
-	// else, RU is working normally and receiving packets, leave her alone =)
-	
-	return (int)pkt_actual_count;
+#else
+	cprintf("e100 tracing is compiled out; build with E100_TRACE=1 or 2\n");
+#endif
+}
+
+void
+nic_e100_clear_trace(void)
+{
+#if E100_TRACE
+	trace_next = 0;
+#endif
 }
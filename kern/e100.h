@@ -1,6 +1,8 @@
 #ifndef JOS_KERN_E100_H
 #define JOS_KERN_E100_H
 
+#include <inc/memlayout.h>
+#include <inc/syscall.h>
 #include <kern/pci.h>
 
 #define MAX_ETH_FRAME	1518
@@ -19,6 +21,13 @@ struct tcb {
 	uint8_t pkt_data[MAX_ETH_FRAME];
 };
 
+// Transmit buffer descriptor, for flexible-mode TCBs
+struct tbd {
+	uint32_t tbd_addr;
+	uint16_t tbd_size;
+	uint16_t tbd_el;	// 1 in the last TBD
+};
+
 struct rfd {
 	struct cb cb;
 	uint32_t reserved;
@@ -27,6 +36,11 @@ struct rfd {
 	uint8_t pkt_data[MAX_ETH_FRAME];
 };
 
+// A received frame's page is handed out with the frame's length in
+// place of actual_count, forming a struct jif_pkt (see inc/ns.h) this
+// many bytes into the page.
+#define RFD_PKT_OFFSET	12
+
 struct pci_record {
 	uint32_t reg_base[6];
 	uint32_t reg_size[6];
@@ -35,11 +49,75 @@ struct pci_record {
 
 struct pci_record pcircd;
 
+// Ring sizes, in slots of a page each, chosen at compile time
+// (make E100_TCB_COUNT=n E100_RFD_COUNT=n)
+#ifndef E100_TCB_COUNT
+#define E100_TCB_COUNT	256
+#endif
+#ifndef E100_RFD_COUNT
+#define E100_RFD_COUNT	256
+#endif
+// Largest ring: the ring's page pointers must fit in a page
+#define E100_RING_MAX	(PGSIZE / sizeof(struct Page *))
+
+struct e100_stats {
+	uint32_t tx_frames;	// frames queued
+	uint32_t tx_errors;
+	uint32_t tx_full;	// transmits refused because the ring was full
+	uint32_t tx_used;	// TCBs holding frames not reclaimed yet
+	uint32_t tx_max_used;
+	uint32_t rx_frames;	// frames handed out
+	uint32_t rx_errors;
+	uint32_t rx_nores;	// times the RU ran out of RFDs, dropping frames
+	uint32_t rx_used;	// received frames waiting, when last looked at
+	uint32_t rx_max_used;
+};
+
+extern struct e100_stats e100_stats;
+
+// Tracing in the driver, chosen at compile time (make E100_TRACE=n):
+// 0 - none, 1 - errors and full rings, 2 - every frame and command too.
+// Events are recorded in a ring of E100_TRACE_SIZE binary records.
+#ifndef E100_TRACE
+#define E100_TRACE	0
+#endif
+#define E100_TRACE_SIZE	1024
+
+enum {
+	E100_EV_TX = 1,		// a frame was queued; arg is its length
+	E100_EV_TX_DONE,	// a frame was sent
+	E100_EV_TX_ERR,		// a frame failed; arg is the TCB status
+	E100_EV_TX_FULL,	// a frame was refused
+	E100_EV_CU_START,
+	E100_EV_CU_RESUME,
+	E100_EV_RX,		// a frame was handed out; arg is its length
+	E100_EV_RX_ERR,		// a bad frame; arg is the RFD status
+	E100_EV_RX_NORES,	// the RU ran out of RFDs
+	E100_EV_RU_START,
+	E100_EV_INTR,		// arg is the STAT/ACK byte
+};
+
+struct e100_trace_rec {
+	uint64_t tr_tsc;
+	uint16_t tr_event;
+	uint16_t tr_slot;
+	uint32_t tr_arg;
+};
+
 
 // Public Functions
 int nic_e100_enable(struct pci_func *);
 int nic_e100_trans_pkt(void *, uint32_t);
+int nic_e100_trans_pkts(pde_t *, const struct TxPkt *, int);
+int nic_e100_trans_wait(void);
 int nic_e100_recv_pkt(void *);
+int nic_e100_recv_pages(pde_t *, void *, int);
+int nic_e100_recv_wait(void);
+void nic_e100_intr(void);
+void nic_e100_print_stats(void);
+void nic_e100_reset_stats(void);
+void nic_e100_print_trace(int);
+void nic_e100_clear_trace(void);
 
 // TCB Command in TCB structure
 #define TCBCMD_NOP		0x0000
@@ -51,6 +129,10 @@ int nic_e100_recv_pkt(void *);
 #define TCBCMD_DUMP		0x0006
 #define TCBCMD_DIAGNOSE		0x0007
 
+// Flexible mode: the data is described by an array of TBDs
+#define TCBCMD_SF		0x0008
+// Interrupt (CX) when this command is done
+#define TCBCMD_I		0x2000
 // Go into Idle state after this frame is processed
 #define TCBCMD_EL		0x8000 
 // Go into Suspended state after this frame is processed
@@ -90,6 +172,15 @@ int nic_e100_recv_pkt(void *);
 #define SCBINT_M		0x0100  // Interrupt mask bit
 
 
+// SCB STAT/ACK byte: write a bit back to acknowledge the interrupt
+#define SCBACK_CX		0x80
+#define SCBACK_FR		0x40
+#define SCBACK_CNA		0x20
+#define SCBACK_RNR		0x10
+#define SCBACK_MDI		0x08
+#define SCBACK_SWI		0x04
+#define SCBACK_FCP		0x01
+
 // SCB Status
 
 #define SCBSTS_CU_IDLE		0x00
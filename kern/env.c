@@ -12,9 +12,19 @@
 #include <kern/trap.h>
 #include <kern/monitor.h>
 #include <kern/sched.h>
+#include <kern/time.h>
+#include <kern/syscall.h>
+#include <kern/perf.h>
 
 struct Env *envs = NULL;		// All environments
 struct Env *curenv = NULL;		// The current env
+
+// CPU accounting (see env_charge)
+static uint64_t acct_tsc;		// TSC when acct_env started being charged
+static struct Env *acct_env;		// env being charged, NULL for the kernel
+static int acct_mode;			// ACCT_ mode acct_env is charged in
+uint64_t acct_kern_cycles;
+uint64_t acct_idle_cycles;
 static struct Env_list env_free_list;	// Free list
 
 #define ENVGENSHIFT	12		// >= LOGNENV
@@ -76,6 +86,7 @@ env_init(void)
 	int i = 0;
 
 	LIST_INIT(&env_free_list);
+	acct_tsc = read_tsc();
 	for (i=NENV-1; i>=0; i--) {
 		envs[i].env_id = 0;
 		envs[i].env_runs = 0;
@@ -98,11 +109,21 @@ static int
 env_setup_vm(struct Env *e)
 {
 	int i, r;
-	struct Page *p = NULL;
+	struct Page *p = NULL, *pt, *vp;
 
 	// Allocate a page for the page directory
 	if ((r = page_alloc(&p)) < 0)
 		return r;
+	// and for the environment's UVSYS page and the page table mapping it
+	if ((r = page_alloc(&pt)) < 0) {
+		page_free(p);
+		return r;
+	}
+	if ((r = page_alloc(&vp)) < 0) {
+		page_free(pt);
+		page_free(p);
+		return r;
+	}
 
 	// Now, set e->env_pgdir and e->env_cr3,
 	// and initialize the page directory.
@@ -143,6 +164,18 @@ env_setup_vm(struct Env *e)
 	e->env_pgdir[PDX(VPT)]  = e->env_cr3 | PTE_P | PTE_W;
 	e->env_pgdir[PDX(UVPT)] = e->env_cr3 | PTE_P | PTE_U;
 
+	// The env gets its own copy of the page table covering UENVS,
+	// with its UVSYS page added.
+	static_assert(PDX(UVSYS) == PDX(UENVS));
+	memmove(page2kva(pt), KADDR(PTE_ADDR(boot_pgdir[PDX(UVSYS)])), PGSIZE);
+	((pte_t *) page2kva(pt))[PTX(UVSYS)] = page2pa(vp) | PTE_P | PTE_U;
+	e->env_pgdir[PDX(UVSYS)] = page2pa(pt) | PTE_P | PTE_U;
+	pt->pp_ref++;
+
+	memset(page2kva(vp), 0, PGSIZE);
+	e->env_vsys = page2kva(vp);
+	vp->pp_ref++;
+
 	return 0;
 }
 
@@ -178,6 +211,12 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	e->env_parent_id = parent_id;
 	e->env_status = ENV_RUNNABLE;
 	e->env_runs = 0;
+	memset(&e->env_stats, 0, sizeof(e->env_stats));
+	e->env_sctrace = 0;
+	memset(&e->env_perf, 0, sizeof(e->env_perf));
+	e->env_vsys->vs_envid = e->env_id;
+	e->env_vsys->vs_parent_id = parent_id;
+	e->env_vsys->vs_flags = (sysenter_enabled ? VSYS_SYSENTER : 0);
 
 	// Clear out all the saved register state,
 	// to prevent the register values
@@ -207,6 +246,11 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	// Also clear the IPC receiving flag.
 	e->env_ipc_recving = 0;
 
+	// No timers are armed.
+	e->env_timer.et_heapidx = -1;
+	e->env_timer.et_fired = 0;
+	e->env_ipc_timeout.et_heapidx = -1;
+
 	// If this is the file server (e == &envs[1]) give it I/O privileges.
 	// LAB 5: Your code here.
 	if (e == &envs[1])
@@ -435,6 +479,18 @@ env_free(struct Env *e)
 	if (e == curenv)
 		lcr3(boot_cr3);
 
+	// Stop charging it for CPU time.
+	if (acct_env == e)
+		env_charge(NULL, ACCT_KERN);
+
+	// Stop tracing its system calls.
+	syscall_trace_free(e);
+	perf_env_free(e);
+
+	// Disarm its timers.
+	timer_cancel(&e->env_timer);
+	timer_cancel(&e->env_ipc_timeout);
+
 	// Note the environment's demise.
 	// cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
@@ -461,6 +517,13 @@ env_free(struct Env *e)
 		page_decref(pa2page(pa));
 	}
 
+	// free the UVSYS page and the page table mapping it
+	pa = PTE_ADDR(e->env_pgdir[PDX(UVSYS)]);
+	pt = (pte_t*) KADDR(pa);
+	page_decref(pa2page(PTE_ADDR(pt[PTX(UVSYS)])));
+	page_decref(pa2page(pa));
+	e->env_vsys = 0;
+
 	// free the page directory
 	pa = e->env_cr3;
 	e->env_pgdir = 0;
@@ -489,6 +552,29 @@ env_destroy(struct Env *e)
 }
 
 
+// Charge the TSC cycles since the last call to whoever was being
+// charged, then start charging 'e' in 'mode'.  'e' is NULL for the
+// kernel working on nobody's behalf (ACCT_KERN) or halted (ACCT_IDLE).
+void
+env_charge(struct Env *e, int mode)
+{
+	uint64_t now = read_tsc();
+	uint64_t cycles = now - acct_tsc;
+
+	if (acct_env && acct_mode == ACCT_USER)
+		acct_env->env_stats.es_user_cycles += cycles;
+	else if (acct_env)
+		acct_env->env_stats.es_kern_cycles += cycles;
+	else if (acct_mode == ACCT_IDLE)
+		acct_idle_cycles += cycles;
+	else
+		acct_kern_cycles += cycles;
+
+	acct_tsc = now;
+	acct_env = e;
+	acct_mode = mode;
+}
+
 //
 // Restores the register values in the Trapframe with the 'iret' instruction.
 // This exits the kernel and starts executing some environment's code.
@@ -535,6 +621,9 @@ env_run(struct Env *e)
 		panic("not runable\n");
 	curenv = e;
 	e->env_runs ++;
+	e->env_vsys->vs_runs = e->env_runs;
+	env_charge(e, ACCT_USER);
+	perf_switch(e);
 	lcr3(e->env_cr3);
 	env_pop_tf(&(e->env_tf));
 }
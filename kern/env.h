@@ -23,6 +23,17 @@ void	env_create(uint8_t *binary, size_t size);
 void	env_destroy(struct Env *e);	// Does not return if e == curenv
 
 int	envid2env(envid_t envid, struct Env **env_store, bool checkperm);
+
+// CPU accounting: cycles are charged to an environment in user or
+// kernel mode, to the kernel on nobody's behalf, or to the idle kernel.
+enum {
+	ACCT_USER,
+	ACCT_KERN,
+	ACCT_IDLE,
+};
+extern uint64_t acct_kern_cycles;	// kernel cycles not charged to an env
+extern uint64_t acct_idle_cycles;	// cycles halted with nothing to run
+void	env_charge(struct Env *e, int mode);
 // The following two functions do not return
 void	env_run(struct Env *e) __attribute__((noreturn));
 void	env_pop_tf(struct Trapframe *tf) __attribute__((noreturn));
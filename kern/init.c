@@ -15,6 +15,8 @@
 #include <kern/picirq.h>
 #include <kern/time.h>
 #include <kern/pci.h>
+#include <kern/kdebug.h>
+#include <kern/perf.h>
 
 unsigned read_eip();
 __inline void record_stack(struct Trapframe *) __attribute__((always_inline));
@@ -47,6 +49,9 @@ i386_init(void)
 	// Can't call cprintf until after we do this!
 	cons_init();
 
+	// Index the kernel's stabs for backtraces and the profiler.
+	kdebug_init();
+
 #if defined(LAB1_ONLY)
 	cprintf("6828 decimal is %o octal!\n", 6828);
 
@@ -77,6 +82,7 @@ i386_init(void)
 	kclock_init();
 
 	time_init();
+	perf_init();
 	pci_init();
 
 	// Should always have an idle process as first one.
@@ -12,6 +12,7 @@
 
 #include <kern/kclock.h>
 #include <kern/picirq.h>
+#include <inc/time.h>
 
 
 unsigned
@@ -28,16 +29,77 @@ mc146818_write(unsigned reg, unsigned datum)
 	outb(IO_RTC+1, datum);
 }
 
+// TSC cycles per millisecond, 0 if the TSC could not be calibrated
+unsigned tsc_khz;
+
+// Count TSC cycles while PIT counter 2, gated through the PPI,
+// counts down CALIBRATE_MSEC milliseconds.
+#define CALIBRATE_MSEC	10
+
+static void
+tsc_calibrate(void)
+{
+	uint64_t start, end;
+	uint32_t loops = 0;
+	uint8_t ppi;
+
+	// gate counter 2 on, speaker off
+	ppi = inb(IO_PPI);
+	outb(IO_PPI, (ppi & ~0x02) | 0x01);
+
+	outb(TIMER_MODE, TIMER_SEL2 | TIMER_INTTC | TIMER_16BIT);
+	outb(TIMER_CNTR2, TIMER_DIV(1000 / CALIBRATE_MSEC) % 256);
+	outb(TIMER_CNTR2, TIMER_DIV(1000 / CALIBRATE_MSEC) / 256);
+
+	// counter 2's output shows up in PPI bit 5 when it reaches 0
+	start = read_tsc();
+	while (!(inb(IO_PPI) & 0x20) && ++loops < 100000000)
+		;
+	end = read_tsc();
+	outb(IO_PPI, ppi);
+
+	if (loops >= 100000000 || end <= start) {
+		cprintf("	TSC calibration failed\n");
+		tsc_khz = 0;
+		return;
+	}
+	tsc_khz = (uint32_t) (end - start) / CALIBRATE_MSEC;
+	cprintf("	TSC runs at %u.%03u MHz\n", tsc_khz / 1000, tsc_khz % 1000);
+}
+
+// Program counter 0 to interrupt every TICK_MSEC milliseconds.
+void
+kclock_periodic(void)
+{
+	outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
+	outb(IO_TIMER1, TIMER_DIV(1000 / TICK_MSEC) % 256);
+	outb(IO_TIMER1, TIMER_DIV(1000 / TICK_MSEC) / 256);
+}
+
+// Program counter 0 to interrupt once, 'msec' milliseconds from now.
+// The counter holds at most KCLOCK_ONESHOT_MAX milliseconds.
+void
+kclock_oneshot(unsigned msec)
+{
+	uint32_t count = TIMER_FREQ / 1000 * msec;
+
+	if (count == 0)
+		count = 1;
+	if (count > 0xffff)
+		count = 0xffff;
+	outb(TIMER_MODE, TIMER_SEL0 | TIMER_INTTC | TIMER_16BIT);
+	outb(IO_TIMER1, count % 256);
+	outb(IO_TIMER1, count / 256);
+}
 
 void
 kclock_init(void)
 {
 	/* initialize 8253 clock to interrupt 100 times/sec */
-	outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
-	outb(IO_TIMER1, TIMER_DIV(100) % 256);
-	outb(IO_TIMER1, TIMER_DIV(100) / 256);
+	kclock_periodic();
 	cprintf("	Setup timer interrupts via 8259A\n");
 	irq_setmask_8259A(irq_mask_8259A & ~(1<<0));
 	cprintf("	unmasked timer interrupt\n");
+	tsc_calibrate();
 }
 
@@ -28,6 +28,13 @@
 
 unsigned mc146818_read(unsigned reg);
 void mc146818_write(unsigned reg, unsigned datum);
+// Longest interval kclock_oneshot can program, in milliseconds
+#define KCLOCK_ONESHOT_MAX	54
+
 void kclock_init(void);
+void kclock_periodic(void);
+void kclock_oneshot(unsigned msec);
+
+extern unsigned tsc_khz;
 
 #endif	// !JOS_KERN_KCLOCK_H
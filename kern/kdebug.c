@@ -110,6 +110,235 @@ stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
 	}
 }
 
+// A program's stabs, boiled down into a table of address ranges sorted
+// by start address.  Each row starts a range of instructions from the
+// same function and source line, so an address is looked up with a
+// single binary search.  kdebug_init builds one for the kernel, and
+// debuginfo_env_cache one for an environment at a time.
+#define SYMTAB_NFUNC	2048
+#define SYMTAB_NROW	16384
+
+struct symtab_func {
+	uintptr_t sf_addr;
+	const char *sf_name;	// not null terminated
+	int16_t sf_namelen;
+	int16_t sf_narg;
+};
+
+struct symtab_row {
+	uintptr_t sr_addr;
+	const char *sr_file;
+	uint16_t sr_line;	// 0 if unknown
+	int16_t sr_func;	// index into st_funcs, -1 if none
+};
+
+struct symtab {
+	int st_nfunc;
+	int st_nrow;		// 0 if the table is unusable
+	struct symtab_func st_funcs[SYMTAB_NFUNC];
+	struct symtab_row st_rows[SYMTAB_NROW];
+};
+
+// The kernel's table
+static struct symtab ksymtab;
+// The table of environment usymtab_env, which must still be
+// usymtab_envid: its names point into the environment's memory.
+static struct symtab usymtab;
+static struct Env *usymtab_env;
+static envid_t usymtab_envid;
+
+static bool
+symtab_add(struct symtab *st, uintptr_t addr, const char *file, int line, int func)
+{
+	struct symtab_row *sr;
+
+	if (st->st_nrow == SYMTAB_NROW)
+		return 0;
+	sr = &st->st_rows[st->st_nrow++];
+	sr->sr_addr = addr;
+	sr->sr_file = file;
+	sr->sr_line = line;
+	sr->sr_func = func;
+	return 1;
+}
+
+// Build table 'st' from the stabs [stabs, stab_end) and their string
+// table [stabstr, stabstr_end), which the caller has checked.
+// Returns 0 on success, -1 if the table is too small.
+static int
+symtab_build(struct symtab *st, const struct Stab *stabs,
+	     const struct Stab *stab_end, const char *stabstr,
+	     const char *stabstr_end)
+{
+	const struct Stab *stab;
+	const char *file = "<unknown>", *name;
+	struct symtab_func *sf = 0;
+	struct symtab_row tmp;
+	int i, j;
+
+	st->st_nfunc = st->st_nrow = 0;
+	for (stab = stabs; stab < stab_end; stab++) {
+		if (stab->n_strx >= stabstr_end - stabstr)
+			continue;
+		name = stabstr + stab->n_strx;
+		switch (stab->n_type) {
+		case N_SO:
+			sf = 0;
+			if (stab->n_value && *name)
+				file = name;
+			break;
+		case N_SOL:
+			file = name;
+			break;
+		case N_FUN:
+			if (!*name) {
+				// the end of the function; n_value is its size
+				if (sf && !symtab_add(st, sf->sf_addr + stab->n_value,
+						      file, 0, -1))
+					goto overflow;
+				sf = 0;
+				break;
+			}
+			if (st->st_nfunc == SYMTAB_NFUNC)
+				goto overflow;
+			sf = &st->st_funcs[st->st_nfunc++];
+			sf->sf_addr = stab->n_value;
+			sf->sf_name = name;
+			sf->sf_namelen = strfind(name, ':') - name;
+			sf->sf_narg = 0;
+			while (stab + 1 < stab_end && stab[1].n_type == N_PSYM) {
+				sf->sf_narg++;
+				stab++;
+			}
+			if (!symtab_add(st, sf->sf_addr, file, 0, sf - st->st_funcs))
+				goto overflow;
+			break;
+		case N_SLINE:
+			// line addresses are relative to the function
+			if (!symtab_add(st, sf ? sf->sf_addr + stab->n_value : stab->n_value,
+					file, stab->n_desc, sf ? sf - st->st_funcs : -1))
+				goto overflow;
+			break;
+		}
+	}
+
+	// The stabs are almost sorted already, so an insertion sort is
+	// quick.  It is stable, so a line row at a function's first
+	// instruction stays after the function's own row.
+	for (i = 1; i < st->st_nrow; i++) {
+		tmp = st->st_rows[i];
+		for (j = i; j > 0 && st->st_rows[j - 1].sr_addr > tmp.sr_addr; j--)
+			st->st_rows[j] = st->st_rows[j - 1];
+		st->st_rows[j] = tmp;
+	}
+	return 0;
+
+overflow:
+	st->st_nrow = 0;
+	return -1;
+}
+
+// Build the kernel's address table from its stabs.  If the table is
+// too small, lookups fall back to searching the stabs.
+void
+kdebug_init(void)
+{
+	const char *stabstr = __STABSTR_BEGIN__, *stabstr_end = __STABSTR_END__;
+
+	if (stabstr_end <= stabstr || stabstr_end[-1] != 0)
+		return;
+	if (symtab_build(&ksymtab, __STAB_BEGIN__, __STAB_END__,
+			 stabstr, stabstr_end) < 0)
+		cprintf("kdebug: more than %d functions or %d lines, using stabs\n",
+			SYMTAB_NFUNC, SYMTAB_NROW);
+}
+
+// Look up 'addr' in table 'st'.
+static int
+symtab_lookup(struct symtab *st, uintptr_t addr, struct Eipdebuginfo *info)
+{
+	struct symtab_row *sr;
+	struct symtab_func *sf;
+	int l = 0, r = st->st_nrow - 1, m;
+
+	// find the last row starting at or before addr
+	if (r < 0 || st->st_rows[0].sr_addr > addr)
+		return -1;
+	while (l < r) {
+		m = (l + r + 1) / 2;
+		if (st->st_rows[m].sr_addr <= addr)
+			l = m;
+		else
+			r = m - 1;
+	}
+	sr = &st->st_rows[l];
+
+	info->eip_file = sr->sr_file;
+	info->eip_line = sr->sr_line;
+	if (sr->sr_func >= 0) {
+		sf = &st->st_funcs[sr->sr_func];
+		info->eip_fn_name = sf->sf_name;
+		info->eip_fn_namelen = sf->sf_namelen;
+		info->eip_fn_addr = sf->sf_addr;
+		info->eip_fn_narg = sf->sf_narg;
+	}
+	return sr->sr_line ? 0 : -1;
+}
+
+// Find e's stabs through the UserStabData at USTABDATA, checking that
+// e may read them.  e's page directory must be loaded.
+static int
+user_stabs(struct Env *e, const struct Stab **stabs, const struct Stab **stab_end,
+	   const char **stabstr, const char **stabstr_end)
+{
+	// The user-application linker script, user/user.ld,
+	// puts information about the application's stabs (equivalent
+	// to __STAB_BEGIN__, __STAB_END__, __STABSTR_BEGIN__, and
+	// __STABSTR_END__) in a structure located at virtual address
+	// USTABDATA.
+	const struct UserStabData *usd = (const struct UserStabData *) USTABDATA;
+
+	// Make sure this memory is valid.
+	if (!e || user_mem_check(e, usd, sizeof(struct UserStabData), PTE_U) < 0)
+		return -1;
+
+	*stabs = usd->stabs;
+	*stab_end = usd->stab_end;
+	*stabstr = usd->stabstr;
+	*stabstr_end = usd->stabstr_end;
+
+	// Make sure the STABS and string table memory is valid.
+	if (user_mem_check(e, *stabs, (uintptr_t) *stab_end - (uintptr_t) *stabs, PTE_U) < 0
+	    || user_mem_check(e, *stabstr, *stabstr_end - *stabstr, PTE_U) < 0)
+		return -1;
+	return 0;
+}
+
+// debuginfo_env_cache(e)
+//
+//	Build a table of e's stabs, so that debuginfo_env_eip looks up e's
+//	addresses with one binary search, as it does the kernel's.
+//	Only one environment's table is kept.  e's page directory must be
+//	loaded, here and whenever its addresses are looked up.
+//	Returns 0 on success, < 0 if e has no usable stabs.
+//
+int
+debuginfo_env_cache(struct Env *e)
+{
+	const struct Stab *stabs, *stab_end;
+	const char *stabstr, *stabstr_end;
+
+	if (usymtab_env == e && usymtab_envid == e->env_id && usymtab.st_nrow)
+		return 0;
+	usymtab_env = 0;
+	if (user_stabs(e, &stabs, &stab_end, &stabstr, &stabstr_end) < 0
+	    || stabstr_end <= stabstr || stabstr_end[-1] != 0
+	    || symtab_build(&usymtab, stabs, stab_end, stabstr, stabstr_end) < 0)
+		return -1;
+	usymtab_env = e;
+	usymtab_envid = e->env_id;
+	return 0;
+}
 
 // debuginfo_eip(addr, info)
 //
@@ -120,6 +349,17 @@ stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
 //
 int
 debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
+{
+	return debuginfo_env_eip(curenv, addr, info);
+}
+
+// debuginfo_env_eip(e, addr, info)
+//
+//	Like debuginfo_eip, but looks up user addresses in the stabs of
+//	environment 'e'.  e's page directory must be loaded.
+//
+int
+debuginfo_env_eip(struct Env *e, uintptr_t addr, struct Eipdebuginfo *info)
 {
 	const struct Stab *stabs, *stab_end;
 	const char *stabstr, *stabstr_end;
@@ -133,6 +373,11 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 	info->eip_fn_addr = addr;
 	info->eip_fn_narg = 0;
 
+	if (addr >= ULIM && ksymtab.st_nrow)
+		return symtab_lookup(&ksymtab, addr, info);
+	if (addr < ULIM && e && e == usymtab_env && e->env_id == usymtab_envid)
+		return symtab_lookup(&usymtab, addr, info);
+
 	// Find the relevant set of stabs
 	if (addr >= ULIM) {
 		stabs = __STAB_BEGIN__;
@@ -140,27 +385,8 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 		stabstr = __STABSTR_BEGIN__;
 		stabstr_end = __STABSTR_END__;
 	} else {
-		// The user-application linker script, user/user.ld,
-		// puts information about the application's stabs (equivalent
-		// to __STAB_BEGIN__, __STAB_END__, __STABSTR_BEGIN__, and
-		// __STABSTR_END__) in a structure located at virtual address
-		// USTABDATA.
-		const struct UserStabData *usd = (const struct UserStabData *) USTABDATA;
-
-		// Make sure this memory is valid.
-		// Return -1 if it is not.  Hint: Call user_mem_check.
-		// LAB 3: Your code here.
-		user_mem_check(curenv, usd, sizeof(struct UserStabData), PTE_U);
-		
-		stabs = usd->stabs;
-		stab_end = usd->stab_end;
-		stabstr = usd->stabstr;
-		stabstr_end = usd->stabstr_end;
-
-		// Make sure the STABS and string table memory is valid.
-		// LAB 3: Your code here.
-		user_mem_check(curenv, stabs, stab_end - stabs, PTE_U);
-		user_mem_check(curenv, stabstr, stabstr_end - stabstr, PTE_U);
+		if (user_stabs(e, &stabs, &stab_end, &stabstr, &stabstr_end) < 0)
+			return -1;
 	}
 
 	// String table validity checks
@@ -15,6 +15,11 @@ struct Eipdebuginfo {
 	int eip_fn_narg;		// Number of function arguments
 };
 
+struct Env;
+
+void kdebug_init(void);
 int debuginfo_eip(uintptr_t eip, struct Eipdebuginfo *info);
+int debuginfo_env_eip(struct Env *e, uintptr_t eip, struct Eipdebuginfo *info);
+int debuginfo_env_cache(struct Env *e);
 
 #endif
@@ -15,6 +15,10 @@
 #include <kern/trap.h>
 #include <kern/pmap.h>
 #include <kern/env.h>
+#include <kern/e100.h>
+#include <kern/syscall.h>
+#include <kern/profile.h>
+#include <kern/perf.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 //#define USING_RECORDED_FRAME 1
@@ -40,6 +44,12 @@ static struct Command commands[] = {
 	{ "page_status", "Show if a page is freed or allocated", mon_pagestatus},
 	{ "continue", "Continue to execute", debug_continue},
 	{ "si", "Signle step execution", debug_si},
+	{ "e100", "Display the NIC's counters, or reset them with 'e100 reset'", mon_e100},
+	{ "e100trace", "Display the last N (default 20) NIC driver events, or clear them with 'e100trace clear'", mon_e100trace},
+	{ "top", "Display the CPU use of each environment since the last 'top'", mon_top},
+	{ "syscalls", "Display system call counts and latencies ('syscalls reset' clears them),\n\t 'syscalls trace ENVID [on|off]' to show or switch ENVID's trace ring", mon_syscalls},
+	{ "profile", "Display where timer interrupts landed, by function, for ENVID ('kernel' for the kernel)\n\t or everything; 'profile on|off|clear' controls sampling", mon_profile},
+	{ "perf", "Display each environment's performance counter totals", mon_perf},
 };
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
 
@@ -295,6 +305,168 @@ mon_showmappings(int argc, char **argv, struct Trapframe *tf)
 	return 0;
 }
 
+int
+mon_e100(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc == 2 && strcmp(argv[1], "reset") == 0)
+		nic_e100_reset_stats();
+	else if (argc != 1) {
+		cprintf("Usage: e100 [reset]\n");
+		return 0;
+	}
+	nic_e100_print_stats();
+	return 0;
+}
+
+int
+mon_e100trace(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc == 2 && strcmp(argv[1], "clear") == 0)
+		nic_e100_clear_trace();
+	else if (argc <= 2)
+		nic_e100_print_trace(argc == 2 ? atoi(argv[1]) : 20);
+	else
+		cprintf("Usage: e100trace [N | clear]\n");
+	return 0;
+}
+
+int
+mon_syscalls(int argc, char **argv, struct Trapframe *tf)
+{
+	envid_t envid;
+	int r = 0;
+
+	if (argc == 1)
+		syscall_print_stats();
+	else if (argc == 2 && strcmp(argv[1], "reset") == 0)
+		syscall_reset_stats();
+	else if ((argc == 3 || argc == 4) && strcmp(argv[1], "trace") == 0) {
+		envid = strtol(argv[2], 0, 16);
+		if (argc == 3)
+			r = syscall_print_trace(envid, SCTRACE_NREC);
+		else if (strcmp(argv[3], "on") == 0)
+			r = syscall_trace(envid, 1);
+		else if (strcmp(argv[3], "off") == 0)
+			r = syscall_trace(envid, 0);
+		else
+			goto usage;
+		if (r < 0)
+			cprintf("syscalls: %e\n", r);
+	} else
+		goto usage;
+	return 0;
+
+usage:
+	cprintf("Usage: syscalls [reset | trace ENVID [on|off]]\n");
+	return 0;
+}
+
+int
+mon_profile(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc == 1)
+		prof_print(-1, 20);
+	else if (argc != 2)
+		cprintf("Usage: profile [on | off | clear | ENVID | kernel]\n");
+	else if (strcmp(argv[1], "on") == 0)
+		prof_enable(1);
+	else if (strcmp(argv[1], "off") == 0)
+		prof_enable(0);
+	else if (strcmp(argv[1], "clear") == 0)
+		prof_clear();
+	else if (strcmp(argv[1], "kernel") == 0)
+		prof_print(0, PROF_NFUNC);
+	else
+		prof_print(strtol(argv[1], 0, 16), PROF_NFUNC);
+	return 0;
+}
+
+int
+mon_perf(int argc, char **argv, struct Trapframe *tf)
+{
+	perf_print();
+	return 0;
+}
+
+// CPU cycles each environment, the kernel and the idle kernel
+// had used at the last 'top'
+static uint64_t top_prev[NENV];
+static envid_t top_prev_id[NENV];
+static uint64_t top_prev_kern, top_prev_idle;
+
+static uint64_t
+top_cycles(struct Env *e)
+{
+	uint64_t cycles = e->env_stats.es_user_cycles + e->env_stats.es_kern_cycles;
+
+	if (top_prev_id[e - envs] == e->env_id)
+		cycles -= top_prev[e - envs];
+	return cycles;
+}
+
+// Print percent 'part' of 'total' to one decimal place.
+static void
+top_percent(uint64_t part, uint64_t total)
+{
+	uint32_t permille = (total ? part * 1000 / total : 0);
+
+	cprintf("%3u.%u%%", permille / 10, permille % 10);
+}
+
+int
+mon_top(int argc, char **argv, struct Trapframe *tf)
+{
+	static int order[NENV];
+	int i, j, n;
+	uint64_t total, kern, idle;
+	struct Env *e;
+
+	env_charge(NULL, ACCT_KERN);
+
+	// alive environments, busiest first
+	n = 0;
+	total = 0;
+	for (i = 0; i < NENV; i++) {
+		if (envs[i].env_status == ENV_FREE)
+			continue;
+		total += top_cycles(&envs[i]);
+		for (j = n++; j > 0 && top_cycles(&envs[order[j - 1]]) < top_cycles(&envs[i]); j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+	kern = acct_kern_cycles - top_prev_kern;
+	idle = acct_idle_cycles - top_prev_idle;
+	total += kern + idle;
+
+	cprintf("%llu kcycles since the last top\n", total / 1000);
+	cprintf("envid      status    cpu  user kcyc  kern kcyc     runs syscalls   faults\n");
+	for (i = 0; i < n; i++) {
+		e = &envs[order[i]];
+		cprintf("%08x %8s ", e->env_id,
+			e->env_status == ENV_RUNNABLE ? "runnable" : "waiting");
+		top_percent(top_cycles(e), total);
+		cprintf(" %10llu %10llu %8u %8u %8u\n",
+			e->env_stats.es_user_cycles / 1000,
+			e->env_stats.es_kern_cycles / 1000,
+			e->env_runs, e->env_stats.es_syscalls,
+			e->env_stats.es_pgfaults);
+	}
+	cprintf("kernel            ");
+	top_percent(kern, total);
+	cprintf("            %10llu\n", acct_kern_cycles / 1000);
+	cprintf("idle              ");
+	top_percent(idle, total);
+	cprintf("\n");
+
+	for (i = 0; i < NENV; i++) {
+		top_prev[i] = envs[i].env_stats.es_user_cycles + envs[i].env_stats.es_kern_cycles;
+		top_prev_id[i] = envs[i].env_id;
+	}
+	top_prev_kern = acct_kern_cycles;
+	top_prev_idle = acct_idle_cycles;
+	return 0;
+}
+
 /***** Kernel monitor command interpreter *****/
 
 #define WHITESPACE "\t\r\n "
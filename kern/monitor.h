@@ -23,5 +23,11 @@ int mon_freepage(int argc, char **argv, struct Trapframe *tf);
 int mon_pagestatus(int argc, char **argv, struct Trapframe *tf);
 int debug_continue(int argc, char **argv, struct Trapframe *tf);
 int debug_si(int argc, char **argv, struct Trapframe *tf);
+int mon_e100(int argc, char **argv, struct Trapframe *tf);
+int mon_e100trace(int argc, char **argv, struct Trapframe *tf);
+int mon_top(int argc, char **argv, struct Trapframe *tf);
+int mon_syscalls(int argc, char **argv, struct Trapframe *tf);
+int mon_profile(int argc, char **argv, struct Trapframe *tf);
+int mon_perf(int argc, char **argv, struct Trapframe *tf);
 
 #endif	// !JOS_KERN_MONITOR_H
@@ -0,0 +1,168 @@
+// Hardware performance counters, through Intel's architectural
+// performance monitoring (CPUID function 0xA).  The counters only count
+// in user mode, and belong to one environment at a time: env_run hands
+// them to the environment it runs, adding what they counted to the
+// previous owner's totals.  On CPUs without architectural performance
+// monitoring, such as QEMU without KVM, nothing is counted.
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/stdio.h>
+
+#include <kern/perf.h>
+#include <kern/env.h>
+
+static struct {
+	const char *name;
+	uint8_t event;
+	uint8_t umask;
+	int archbit;	// bit in CPUID 0xA's EBX, -1 if model-specific
+} perf_events[PERF_NEVENT] = {
+	[PERF_CYCLES] = { "cycles", 0x3c, 0x00, 0 },
+	[PERF_INSTRS] = { "instrs", 0xc0, 0x00, 1 },
+	[PERF_LLC_MISSES] = { "llc misses", 0x2e, 0x41, 4 },
+	// DTLB_LOAD_MISSES on Core and later; not architectural
+	[PERF_DTLB_MISSES] = { "dtlb misses", 0x08, 0x01, -1 },
+};
+
+// Events being counted, (1 << PERF_CYCLES) | ...
+uint32_t perf_mask;
+// Counter counting each event
+static int perf_ctr[PERF_NEVENT];
+static uint64_t perf_width_mask;
+// Environment the counters are counting for, if any
+static struct Env *perf_owner;
+
+void
+perf_init(void)
+{
+	uint32_t max, eax, ebx, version, nctr, width, veclen, family;
+	int i, n;
+
+	cpuid(0, &max, 0, 0, 0);
+	if (max < 0xa) {
+		cprintf("perf: no performance counters\n");
+		return;
+	}
+	cpuid(0xa, &eax, &ebx, 0, 0);
+	version = eax & 0xff;
+	nctr = (eax >> 8) & 0xff;
+	width = (eax >> 16) & 0xff;
+	veclen = eax >> 24;
+	if (version == 0 || nctr == 0 || width == 0 || width > 64) {
+		cprintf("perf: no performance counters\n");
+		return;
+	}
+	cpuid(1, &eax, 0, 0, 0);
+	family = (eax >> 8) & 0xf;
+	perf_width_mask = ~0ULL >> (64 - width);
+
+	n = 0;
+	for (i = 0; i < PERF_NEVENT && n < nctr; i++) {
+		if (perf_events[i].archbit >= 0
+		    ? (perf_events[i].archbit >= veclen
+		       || (ebx & (1 << perf_events[i].archbit)))
+		    : family != 6)
+			continue;
+		wrmsr(MSR_PERFEVTSEL0 + n, perf_events[i].event
+		      | (perf_events[i].umask << 8)
+		      | PERFEVTSEL_USR | PERFEVTSEL_EN);
+		wrmsr(MSR_PMC0 + n, 0);
+		perf_ctr[i] = n++;
+		perf_mask |= 1 << i;
+	}
+	if (version >= 2)
+		wrmsr(MSR_PERF_GLOBAL_CTRL, (1ULL << n) - 1);
+
+	cprintf("perf: counting");
+	for (i = 0; i < PERF_NEVENT; i++)
+		if (perf_mask & (1 << i))
+			cprintf(" %s", perf_events[i].name);
+	cprintf("\n");
+}
+
+// Add what the counters counted to their owner's totals
+// and start them again from 0.
+static void
+perf_flush(void)
+{
+	uint64_t count;
+	int i;
+
+	for (i = 0; i < PERF_NEVENT; i++) {
+		if (!(perf_mask & (1 << i)))
+			continue;
+		count = rdpmc(perf_ctr[i]) & perf_width_mask;
+		if (perf_owner)
+			perf_owner->env_perf.ep_count[i] += count;
+		wrmsr(MSR_PMC0 + perf_ctr[i], 0);
+	}
+}
+
+// Count for e from now on, called as e is about to run.
+void
+perf_switch(struct Env *e)
+{
+	if (!perf_mask || e == perf_owner)
+		return;
+	perf_flush();
+	perf_owner = e;
+}
+
+void
+perf_env_free(struct Env *e)
+{
+	if (perf_mask && e == perf_owner) {
+		perf_flush();
+		perf_owner = 0;
+	}
+}
+
+// Copy e's totals to 'perf', and return perf_mask.
+int
+perf_read(struct Env *e, struct EnvPerf *perf)
+{
+	if (perf_mask && e == perf_owner)
+		perf_flush();
+	*perf = e->env_perf;
+	return perf_mask;
+}
+
+// Print every alive environment's totals.
+void
+perf_print(void)
+{
+	struct Env *e;
+	uint64_t cycles;
+	int i;
+
+	if (!perf_mask) {
+		cprintf("No performance counters\n");
+		return;
+	}
+	if (perf_owner)
+		perf_flush();
+
+	cprintf("envid   ");
+	for (i = 0; i < PERF_NEVENT; i++)
+		if (perf_mask & (1 << i))
+			cprintf(" %14s", perf_events[i].name);
+	if ((perf_mask & (1 << PERF_CYCLES)) && (perf_mask & (1 << PERF_INSTRS)))
+		cprintf("    ipc");
+	cprintf("\n");
+	for (e = envs; e < envs + NENV; e++) {
+		if (e->env_status == ENV_FREE)
+			continue;
+		cprintf("%08x", e->env_id);
+		for (i = 0; i < PERF_NEVENT; i++)
+			if (perf_mask & (1 << i))
+				cprintf(" %14llu", e->env_perf.ep_count[i]);
+		cycles = e->env_perf.ep_count[PERF_CYCLES];
+		if ((perf_mask & (1 << PERF_CYCLES)) && (perf_mask & (1 << PERF_INSTRS))
+		    && cycles)
+			cprintf("  %2u.%02u",
+				(uint32_t) (e->env_perf.ep_count[PERF_INSTRS] / cycles),
+				(uint32_t) (e->env_perf.ep_count[PERF_INSTRS] * 100 / cycles % 100));
+		cprintf("\n");
+	}
+}
@@ -0,0 +1,17 @@
+#ifndef JOS_KERN_PERF_H
+#define JOS_KERN_PERF_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+
+extern uint32_t perf_mask;
+
+void perf_init(void);
+void perf_switch(struct Env *e);
+void perf_env_free(struct Env *e);
+int perf_read(struct Env *e, struct EnvPerf *perf);
+void perf_print(void);
+
+#endif /* JOS_KERN_PERF_H */
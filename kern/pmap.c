@@ -9,6 +9,7 @@
 #include <kern/pmap.h>
 #include <kern/kclock.h>
 #include <kern/env.h>
+#include <kern/time.h>
 
 // These variables are set by i386_detect_memory()
 static physaddr_t maxpa;	// Maximum physical address
@@ -196,6 +197,11 @@ i386_vm_init(void)
 	envs = boot_alloc(sizeof(struct Env) * NENV, PGSIZE);
 	memset(envs, 0, sizeof(struct Env) * NENV);
 
+	//////////////////////////////////////////////////////////////////////
+	// Make 'timepage' point to the page holding the kernel clock.
+	timepage = boot_alloc(PGSIZE, PGSIZE);
+	memset(timepage, 0, PGSIZE);
+
 	//////////////////////////////////////////////////////////////////////
 	// Now that we've allocated the initial kernel data structures, we set
 	// up the list of free physical pages. Once we've done so, all further
@@ -228,6 +234,12 @@ i386_vm_init(void)
 	// LAB 3: Your code here.
 	boot_map_segment(pgdir, UENVS, ROUNDUP(NENV*sizeof(struct Env), PGSIZE), (physaddr_t)PADDR(envs), PTE_U | PTE_P);
 
+	//////////////////////////////////////////////////////////////////////
+	// Map the clock read-only by the user at linear address UTIME,
+	// so that environments can read the time without a system call.
+	static_assert(NENV*sizeof(struct Env) <= UVSYS - UENVS);
+	boot_map_segment(pgdir, UTIME, PGSIZE, (physaddr_t)PADDR(timepage), PTE_U | PTE_P);
+
 	//////////////////////////////////////////////////////////////////////
         // Use the physical memory that bootstack refers to as
         // the kernel stack.  The complete VA
@@ -391,6 +403,9 @@ check_boot_pgdir(void)
 	for (i = 0; i < n; i += PGSIZE)
 		assert(check_va2pa(pgdir, UENVS + i) == PADDR(envs) + i);
 
+	// check clock page
+	assert(check_va2pa(pgdir, UTIME) == PADDR(timepage));
+
 	// check phys mem
 	for (i = 0; i < npage * PGSIZE; i += PGSIZE)
 		assert(check_va2pa(pgdir, KERNBASE + i) == i);
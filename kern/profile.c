@@ -0,0 +1,173 @@
+// Statistical profiler: every timer interrupt records where it
+// interrupted, and the monitor's 'profile' command counts the samples
+// by function, using the kernel's stabs or those of the environment
+// that was running (see user/user.ld).
+
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <inc/stdio.h>
+
+#include <kern/profile.h>
+#include <kern/env.h>
+#include <kern/kdebug.h>
+#include <kern/pmap.h>
+
+static struct ProfSample prof_samples[PROF_NSAMPLE];
+static int prof_nsample;
+static uint32_t prof_dropped;
+static bool prof_on;
+
+// Samples counted by function
+struct prof_func {
+	envid_t pf_envid;
+	uintptr_t pf_addr;
+	char pf_name[32];
+	uint32_t pf_count;
+};
+
+static struct prof_func prof_funcs[PROF_NFUNC];
+static int prof_nfunc;
+static uint32_t prof_other;
+
+// Record the interrupted eip, called on each timer interrupt.
+void
+prof_sample(struct Trapframe *tf)
+{
+	struct ProfSample *ps;
+
+	if (!prof_on)
+		return;
+	if (prof_nsample == PROF_NSAMPLE) {
+		prof_dropped++;
+		return;
+	}
+	ps = &prof_samples[prof_nsample++];
+	ps->ps_envid = (tf->tf_cs & 3) == 3 && curenv ? curenv->env_id : 0;
+	ps->ps_eip = tf->tf_eip;
+}
+
+void
+prof_enable(bool on)
+{
+	prof_on = on;
+}
+
+void
+prof_clear(void)
+{
+	prof_nsample = 0;
+	prof_dropped = 0;
+}
+
+static void
+prof_count(envid_t envid, uintptr_t addr, const char *name, int namelen)
+{
+	struct prof_func *pf;
+
+	for (pf = prof_funcs; pf < prof_funcs + prof_nfunc; pf++)
+		if (pf->pf_envid == envid && pf->pf_addr == addr) {
+			pf->pf_count++;
+			return;
+		}
+	if (prof_nfunc == PROF_NFUNC) {
+		prof_other++;
+		return;
+	}
+	pf = &prof_funcs[prof_nfunc++];
+	pf->pf_envid = envid;
+	pf->pf_addr = addr;
+	if (namelen >= sizeof(pf->pf_name))
+		namelen = sizeof(pf->pf_name) - 1;
+	memmove(pf->pf_name, name, namelen);
+	pf->pf_name[namelen] = '\0';
+	pf->pf_count = 1;
+}
+
+// Print the 'n' functions with the most samples, over all environments
+// and the kernel if envid is -1, or only over envid (0 for the kernel).
+// An environment's addresses can only be looked up while it's alive.
+void
+prof_print(envid_t envid, int n)
+{
+	struct ProfSample *ps;
+	struct prof_func *pf, tmp;
+	struct Eipdebuginfo info;
+	struct Env *e;
+	static envid_t sampled[NENV];
+	uint32_t cr3 = rcr3();
+	uint32_t total = 0;
+	int i, j, nsampled = 0;
+
+	prof_nfunc = 0;
+	prof_other = 0;
+
+	// The kernel's samples, noting the environments sampled
+	for (ps = prof_samples; ps < prof_samples + prof_nsample; ps++) {
+		if (envid != -1 && ps->ps_envid != envid)
+			continue;
+		total++;
+		if (ps->ps_envid == 0) {
+			debuginfo_eip(ps->ps_eip, &info);
+			prof_count(0, info.eip_fn_addr, info.eip_fn_name,
+				   info.eip_fn_namelen);
+			continue;
+		}
+		for (i = 0; i < nsampled && sampled[i] != ps->ps_envid; i++)
+			;
+		if (i == nsampled && nsampled < NENV)
+			sampled[nsampled++] = ps->ps_envid;
+	}
+
+	// Then each environment's, building a table of its stabs once
+	// rather than searching them for every sample
+	for (i = 0; i < nsampled; i++) {
+		e = &envs[ENVX(sampled[i])];
+		if (e->env_id != sampled[i] || e->env_status == ENV_FREE)
+			e = 0;
+		else {
+			lcr3(e->env_cr3);
+			debuginfo_env_cache(e);
+		}
+		for (ps = prof_samples; ps < prof_samples + prof_nsample; ps++) {
+			if (ps->ps_envid != sampled[i])
+				continue;
+			if (!e)
+				prof_count(ps->ps_envid, 0, "(exited)", 8);
+			else if (debuginfo_env_eip(e, ps->ps_eip, &info) < 0)
+				prof_count(ps->ps_envid, 0, "(no stabs)", 10);
+			else
+				prof_count(ps->ps_envid, info.eip_fn_addr,
+					   info.eip_fn_name, info.eip_fn_namelen);
+		}
+	}
+	lcr3(cr3);
+
+	// most samples first
+	for (i = 1; i < prof_nfunc; i++) {
+		tmp = prof_funcs[i];
+		for (j = i; j > 0 && prof_funcs[j - 1].pf_count < tmp.pf_count; j--)
+			prof_funcs[j] = prof_funcs[j - 1];
+		prof_funcs[j] = tmp;
+	}
+
+	cprintf("%u samples%s", total, prof_on ? " (profiling)" : "");
+	if (prof_dropped)
+		cprintf(", %u dropped when the buffer filled", prof_dropped);
+	cprintf("\n");
+	if (total == 0)
+		return;
+	cprintf(" samples     %%  envid     function\n");
+	for (i = 0; i < prof_nfunc && i < n; i++) {
+		pf = &prof_funcs[i];
+		cprintf("%8u %3u.%u  ", pf->pf_count,
+			pf->pf_count * 100 / total,
+			pf->pf_count * 1000 / total % 10);
+		if (pf->pf_envid)
+			cprintf("%08x  ", pf->pf_envid);
+		else
+			cprintf("kernel    ");
+		cprintf("%s\n", pf->pf_name);
+	}
+	if (prof_other)
+		cprintf("%8u samples in other functions\n", prof_other);
+}
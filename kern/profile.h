@@ -0,0 +1,24 @@
+#ifndef JOS_KERN_PROFILE_H
+#define JOS_KERN_PROFILE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+#include <inc/trap.h>
+
+#define PROF_NSAMPLE	8192	// samples kept until the profile is cleared
+#define PROF_NFUNC	128	// distinct functions a profile can show
+
+// One timer interrupt's worth of profile: where it interrupted.
+struct ProfSample {
+	envid_t ps_envid;	// 0 if the kernel was interrupted
+	uintptr_t ps_eip;
+};
+
+void prof_sample(struct Trapframe *tf);
+void prof_enable(bool on);
+void prof_clear(void);
+void prof_print(envid_t envid, int n);
+
+#endif /* JOS_KERN_PROFILE_H */
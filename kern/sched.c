@@ -3,6 +3,25 @@
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/time.h>
+
+// Nothing is runnable: wait in the kernel, with interrupts enabled,
+// for an interrupt to make something runnable.  The interrupt's trap()
+// finds curenv NULL and calls sched_yield again, abandoning this stack.
+static void __attribute__((noreturn))
+sched_halt(void)
+{
+	curenv = NULL;
+	env_charge(NULL, ACCT_IDLE);
+	time_idle();
+	asm volatile("movl %0, %%esp\n"
+		     "sti\n"
+		     "1:\thlt\n"
+		     "jmp 1b"
+		     : : "i" (KSTACKTOP));
+	while (1)
+		;
+}
 
 
 // Choose a user environment to run and run it.
@@ -21,6 +40,8 @@ sched_yield(void)
 	// LAB 4: Your code here.
 	int i, curi;
 
+	time_resume();
+
 	// First time of calling sched_yield
 	if (curenv == NULL)
 		curenv = envs;
@@ -38,7 +59,14 @@ sched_yield(void)
 	if (envs[curi].env_status == ENV_RUNNABLE)
 		env_run(&envs[curi]);
 
-	// Run the special idle environment when nothing else is runnable.
+	// Wait for an interrupt if some environment is still alive and
+	// may be woken by one: an IPC, a timer or the NIC.
+	for (i = 1; i < NENV; i++)
+		if (envs[i].env_status != ENV_FREE)
+			sched_halt();
+
+	// Run the special idle environment when nothing else is alive;
+	// it breaks into the monitor.
 	if (envs[0].env_status == ENV_RUNNABLE)
 		env_run(&envs[0]);
 	else {
@@ -13,6 +13,7 @@
 #include <kern/sched.h>
 #include <kern/time.h>
 #include <kern/e100.h>
+#include <kern/perf.h>
 
 // Print a string to the system console.
 // The string is exactly 'len' characters long.
@@ -406,6 +407,7 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 		ret = 1;
 	}
 
+	timer_cancel(&env->env_ipc_timeout);
 	env->env_ipc_recving = 0;
 	env->env_ipc_from = curenv->env_id;
 	env->env_ipc_value = value;
@@ -419,20 +421,39 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 //
 // If 'dstva' is < UTOP, then you are willing to receive a page of data.
 // 'dstva' is the virtual address at which the sent page should be mapped.
+// 'npages' is the number of pages starting at 'dstva' that a
+// multi-page IPC (sys_ipc_try_send_pages) may map; 0 means 1.
+//
+// If a sys_timer_set notification is pending, it is received at once
+// as a value from envid 0.
 //
 // This function only returns on error, but the system call will eventually
 // return 0 on success.
 // Return < 0 on error.  Errors are:
-//	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_INVAL if dstva < UTOP but dstva is not page-aligned,
+//		or the area of 'npages' pages at dstva extends above UTOP.
 static int
-sys_ipc_recv(void *dstva)
+sys_ipc_recv(void *dstva, uint32_t npages)
 {
 	// LAB 4: Your code here.
+	if (npages == 0)
+		npages = 1;
 	if (((uint32_t)dstva < UTOP) && (dstva != ROUNDDOWN(dstva, PGSIZE)))
 		return -E_INVAL;
+	if (((uint32_t)dstva < UTOP) && npages > (UTOP - (uint32_t)dstva) / PGSIZE)
+		return -E_INVAL;
+
+	if (curenv->env_timer.et_fired) {
+		curenv->env_timer.et_fired = 0;
+		curenv->env_ipc_from = 0;
+		curenv->env_ipc_value = curenv->env_timer.et_value;
+		curenv->env_ipc_perm = 0;
+		return 0;
+	}
 
 	curenv->env_ipc_recving = 1;
 	curenv->env_ipc_dstva = dstva;
+	curenv->env_ipc_dstnpg = npages;
 	curenv->env_status = ENV_NOT_RUNNABLE;
 
 	/* sched_yield(); cannot be used here! trap() will call sched_yield at the end.
@@ -443,6 +464,166 @@ sys_ipc_recv(void *dstva)
 	return 0;
 }
 
+// Like sys_ipc_recv, but give up at time_msec() 'deadline':
+// if nothing has been received by then, the system call returns
+// -E_TIMEOUT.  A deadline of ~0 waits forever.
+//
+// Return < 0 on error.  Errors are those of sys_ipc_recv, and:
+//	-E_TIMEOUT if the deadline has passed.
+static int
+sys_ipc_recv_timeout(void *dstva, uint32_t npages, uint32_t deadline)
+{
+	int r;
+
+	if (!curenv->env_timer.et_fired && deadline <= time_msec())
+		return -E_TIMEOUT;
+	if ((r = sys_ipc_recv(dstva, npages)) < 0)
+		return r;
+	if (curenv->env_ipc_recving && deadline != ~0U)
+		timer_arm(&curenv->env_ipc_timeout, deadline);
+	return 0;
+}
+
+// Arm envid's timer to fire at time_msec() 'deadline', replacing
+// any earlier setting.  When it fires, the environment receives
+// 'value' as though sent by envid 0 with sys_ipc_try_send; if it is
+// not receiving then, the value waits for its next sys_ipc_recv.
+// A deadline of 0 disarms the timer and drops any waiting value.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+static int
+sys_timer_set(envid_t envid, uint32_t deadline, uint32_t value)
+{
+	struct Env *env;
+	int r;
+
+	if ((r = envid2env(envid, &env, 1)) < 0)
+		return r;
+
+	env->env_timer.et_fired = 0;
+	if (deadline == 0) {
+		timer_cancel(&env->env_timer);
+		return 0;
+	}
+	env->env_timer.et_value = value;
+	timer_arm(&env->env_timer, deadline);
+	return 0;
+}
+
+// Store envid's CPU accounting in *stats.
+// Any environment's accounting may be read.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+static int
+sys_env_stats(envid_t envid, struct EnvStats *stats)
+{
+	struct Env *env;
+	int r;
+
+	if ((r = envid2env(envid, &env, 0)) < 0)
+		return r;
+	user_mem_assert(curenv, stats, sizeof(*stats), PTE_U | PTE_W);
+
+	// bring the caller's own cycles up to date
+	if (env == curenv)
+		env_charge(curenv, ACCT_KERN);
+	*stats = env->env_stats;
+	return 0;
+}
+
+// Copy envid's performance counter totals to 'perf'.
+// Returns a mask of the PERF_ events being counted, 1 << PERF_CYCLES
+// and so on; 0 if the CPU has no performance counters the kernel knows.
+// Events that aren't counted read as 0.
+static int
+sys_env_perf(envid_t envid, struct EnvPerf *perf)
+{
+	struct Env *env;
+	int r;
+
+	if ((r = envid2env(envid, &env, 0)) < 0)
+		return r;
+	user_mem_assert(curenv, perf, sizeof(*perf), PTE_U | PTE_W);
+	return perf_read(env, perf);
+}
+
+// Like sys_ipc_try_send, but send the 'n' pages described by 'pgs'.
+// Page pgs[i].ip_srcva in the caller is mapped at
+// env_ipc_dstva + pgs[i].ip_dstpg*PGSIZE in the receiver, with
+// permission pgs[i].ip_perm.  The receiver's env_ipc_perm is set to the
+// permission of the first page.  If the receiver is not asking for pages,
+// the value is delivered without any.
+//
+// Returns the number of pages mapped on success, < 0 on error.
+// Errors are those of sys_ipc_try_send, and:
+//	-E_INVAL if some ip_dstpg is outside the receiver's receive area.
+//	-E_NO_MEM if there's no memory for the receiver's page tables.
+// Everything is checked, and the page tables allocated, before anything
+// is mapped, so either all the pages are sent or none is.
+static int
+sys_ipc_try_send_pages(envid_t envid, uint32_t value, struct IpcPage *pgs, uint32_t n)
+{
+	struct Env *env;
+	int err;
+	uint32_t i;
+	pte_t *pte;
+	struct Page *pp;
+	int perm;
+	char *dstva;
+
+	if ((err = envid2env(envid, &env, 0)) < 0)
+		return err;
+	if (env->env_ipc_recving == 0)
+		return -E_IPC_NOT_RECV;
+
+	if ((uint32_t)env->env_ipc_dstva >= UTOP)
+		n = 0;
+	if (n > UTOP / PGSIZE)
+		return -E_INVAL;
+	user_mem_assert(curenv, pgs, n * sizeof(struct IpcPage), PTE_U);
+
+	for (i = 0; i < n; i++) {
+		perm = pgs[i].ip_perm;
+		if (((perm & (~PTE_USER)) != 0) || ((perm & (PTE_U | PTE_P)) != (PTE_U | PTE_P)))
+			return -E_INVAL;
+		if ((uint32_t)pgs[i].ip_srcva >= UTOP || PGOFF(pgs[i].ip_srcva) != 0)
+			return -E_INVAL;
+		if ((pp = page_lookup(curenv->env_pgdir, pgs[i].ip_srcva, &pte)) == NULL)
+			return -E_INVAL;
+		if (((*pte & PTE_W) == 0) && (perm & PTE_W))
+			return -E_INVAL;
+		if (pgs[i].ip_dstpg >= env->env_ipc_dstnpg)
+			return -E_INVAL;
+	}
+
+	// Allocate any page tables the mappings need up front, so that
+	// page_insert can't fail below.
+	for (i = 0; i < n; i++) {
+		dstva = (char *) env->env_ipc_dstva + pgs[i].ip_dstpg * PGSIZE;
+		if (!pgdir_walk(env->env_pgdir, dstva, 1))
+			return -E_NO_MEM;
+	}
+
+	for (i = 0; i < n; i++) {
+		pp = page_lookup(curenv->env_pgdir, pgs[i].ip_srcva, 0);
+		dstva = (char *) env->env_ipc_dstva + pgs[i].ip_dstpg * PGSIZE;
+		if ((err = page_insert(env->env_pgdir, pp, dstva,
+				       pgs[i].ip_perm)) < 0)
+			panic("sys_ipc_try_send_pages: page_insert: %e", err);
+	}
+
+	env->env_ipc_perm = (n > 0 ? pgs[0].ip_perm : 0);
+	timer_cancel(&env->env_ipc_timeout);
+	env->env_ipc_recving = 0;
+	env->env_ipc_from = curenv->env_id;
+	env->env_ipc_value = value;
+	env->env_status = ENV_RUNNABLE;
+	return n;
+}
+
 // Return the current time.
 static int
 sys_time_msec(void) 
@@ -451,6 +632,23 @@ sys_time_msec(void)
 	return time_msec();
 }
 
+// Return the current time in microseconds.
+// The value wraps around about every 71 minutes.
+static int
+sys_time_usec(void)
+{
+	return (uint32_t) (time_nsec() / 1000);
+}
+
+// Store the current time in nanoseconds in *nsec.
+static int
+sys_time_nsec(uint64_t *nsec)
+{
+	user_mem_assert(curenv, nsec, sizeof(*nsec), PTE_U | PTE_W);
+	*nsec = time_nsec();
+	return 0;
+}
+
 static int
 sys_transmit_packet(void *pkt_data, uint32_t datalen)
 {
@@ -468,9 +666,82 @@ sys_receive_packet(void *va)
 	return pkt_len;
 }
 
+// Transmit the 'n' frames described by 'pkts', each made of up to
+// TXFRAG_MAX pieces.  The NIC reads the pieces straight from the pages
+// they are in: the kernel holds a reference to each page until its frame
+// has been sent, so the caller may unmap the pages at once, but must not
+// change them.
+// Returns the number of frames queued, which is less than n if the
+// transmit ring fills up (the caller should retry the rest later),
+// or < 0 on error:
+//	-E_TX_FULL if the transmit ring is full, so no frame was queued.
+//	-E_INVAL if n is 0 or more than TXPKT_MAX, if a frame has no pieces
+//		or more than TXFRAG_MAX, if a piece is empty or crosses a page
+//		boundary, or if a frame is longer than MAX_ETH_FRAME.
+// Destroys the environment if 'pkts' or a piece is not readable.
+static int
+sys_transmit_packets(const struct TxPkt *pkts, uint32_t n)
+{
+	uint32_t i, j, len;
+	const struct TxFrag *f;
+
+	if (n == 0 || n > TXPKT_MAX)
+		return -E_INVAL;
+	user_mem_assert(curenv, pkts, n * sizeof(struct TxPkt), PTE_U);
+	for (i = 0; i < n; i++) {
+		if (pkts[i].tp_nfrag == 0 || pkts[i].tp_nfrag > TXFRAG_MAX)
+			return -E_INVAL;
+		len = 0;
+		for (j = 0; j < pkts[i].tp_nfrag; j++) {
+			f = &pkts[i].tp_frags[j];
+			if (f->tf_len == 0 || PGOFF(f->tf_va) + f->tf_len > PGSIZE)
+				return -E_INVAL;
+			user_mem_assert(curenv, f->tf_va, f->tf_len, PTE_U);
+			len += f->tf_len;
+		}
+		if (len > MAX_ETH_FRAME)
+			return -E_INVAL;
+	}
+	return nic_e100_trans_pkts(curenv->env_pgdir, pkts, n);
+}
+
+// Map the pages holding up to 'n' received frames at 'va', va+PGSIZE,
+// ..., replacing any pages mapped there.  Each page holds a struct
+// jif_pkt describing its frame RFD_PKT_OFFSET bytes in.
+// Returns the number of frames mapped, 0 if no frame has been received,
+// or < 0 on error:
+//	-E_INVAL if the n pages at va are not all below UTOP, or va is not
+//		page-aligned.
+//	-E_NO_MEM if there's no memory for a replacement page or for a
+//		page table.
+static int
+sys_receive_pages(void *va, uint32_t n)
+{
+	if ((uint32_t)va >= UTOP || PGOFF(va) != 0
+	    || n > (UTOP - (uint32_t)va) / PGSIZE)
+		return -E_INVAL;
+	return nic_e100_recv_pages(curenv->env_pgdir, va, n);
+}
+
+// Block until a received frame is waiting for sys_receive_packet.
+// Returns 0 (possibly after blocking).
+static int
+sys_receive_wait(void)
+{
+	return nic_e100_recv_wait();
+}
+
+// Block until the transmit ring has a free slot.
+// Returns 0 (possibly after blocking).
+static int
+sys_transmit_wait(void)
+{
+	return nic_e100_trans_wait();
+}
+
 // Dispatches to the correct kernel function, passing the arguments.
-int32_t
-syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
+static int32_t
+syscall_dispatch(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
 {
 	// Call the function corresponding to the 'syscallno' parameter.
 	// Return any appropriate return value.
@@ -513,7 +784,7 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 		ret = sys_env_set_pgfault_upcall((envid_t)a1, (void *)a2);
 		break;
 	case SYS_ipc_recv:
-		ret = sys_ipc_recv((void *)a1);
+		ret = sys_ipc_recv((void *)a1, a2);
 		break;
 	case SYS_ipc_try_send:
 		ret = sys_ipc_try_send((envid_t)a1, (uint32_t)a2, (void *)a3, (unsigned)a4);
@@ -530,6 +801,39 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 	case SYS_receive_packet:
 		ret = sys_receive_packet((void *)a1);
 		break;
+	case SYS_ipc_try_send_pages:
+		ret = sys_ipc_try_send_pages((envid_t)a1, a2, (struct IpcPage *)a3, a4);
+		break;
+	case SYS_receive_wait:
+		ret = sys_receive_wait();
+		break;
+	case SYS_transmit_wait:
+		ret = sys_transmit_wait();
+		break;
+	case SYS_receive_pages:
+		ret = sys_receive_pages((void *)a1, a2);
+		break;
+	case SYS_transmit_packets:
+		ret = sys_transmit_packets((const struct TxPkt *)a1, a2);
+		break;
+	case SYS_ipc_recv_timeout:
+		ret = sys_ipc_recv_timeout((void *)a1, a2, a3);
+		break;
+	case SYS_timer_set:
+		ret = sys_timer_set((envid_t)a1, a2, a3);
+		break;
+	case SYS_time_usec:
+		ret = sys_time_usec();
+		break;
+	case SYS_time_nsec:
+		ret = sys_time_nsec((uint64_t *)a1);
+		break;
+	case SYS_env_stats:
+		ret = sys_env_stats((envid_t)a1, (struct EnvStats *)a2);
+		break;
+	case SYS_env_perf:
+		ret = sys_env_perf((envid_t)a1, (struct EnvPerf *)a2);
+		break;
 	default:
 		return -E_INVAL;
 	}
@@ -537,3 +841,205 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 	return ret;
 }
 
+/***** System call statistics and tracing *****/
+
+static const char * const syscall_names[NSYSCALLS] = {
+	[SYS_cputs] = "cputs",
+	[SYS_cgetc] = "cgetc",
+	[SYS_getenvid] = "getenvid",
+	[SYS_env_destroy] = "env_destroy",
+	[SYS_page_alloc] = "page_alloc",
+	[SYS_page_map] = "page_map",
+	[SYS_page_unmap] = "page_unmap",
+	[SYS_exofork] = "exofork",
+	[SYS_env_set_status] = "env_set_status",
+	[SYS_env_set_trapframe] = "env_set_trapframe",
+	[SYS_env_set_pgfault_upcall] = "env_set_pgfault_upcall",
+	[SYS_yield] = "yield",
+	[SYS_ipc_try_send] = "ipc_try_send",
+	[SYS_ipc_recv] = "ipc_recv",
+	[SYS_time_msec] = "time_msec",
+	[SYS_transmit_packet] = "transmit_packet",
+	[SYS_receive_packet] = "receive_packet",
+	[SYS_ipc_try_send_pages] = "ipc_try_send_pages",
+	[SYS_receive_wait] = "receive_wait",
+	[SYS_receive_pages] = "receive_pages",
+	[SYS_transmit_packets] = "transmit_packets",
+	[SYS_ipc_recv_timeout] = "ipc_recv_timeout",
+	[SYS_timer_set] = "timer_set",
+	[SYS_time_usec] = "time_usec",
+	[SYS_time_nsec] = "time_nsec",
+	[SYS_env_stats] = "env_stats",
+	[SYS_env_perf] = "env_perf",
+	[SYS_transmit_wait] = "transmit_wait",
+};
+
+// Per system call counts and log2 histograms of the cycles they took.
+// Calls that never return to syscall(), such as sys_yield, are counted
+// but not timed.
+static struct syscall_stat {
+	uint32_t ss_calls;
+	uint32_t ss_timed;
+	uint64_t ss_cycles;
+	uint32_t ss_hist[SYSCALL_HIST_BUCKETS];	// calls taking [2^i, 2^(i+1))
+} syscall_stats[NSYSCALLS];
+
+static int
+log2_bucket(uint32_t cycles)
+{
+	int i = 0;
+
+	while (cycles >>= 1)
+		i++;
+	return i;
+}
+
+// Enter the kernel function for a system call, counting and timing it
+// and recording it in the calling environment's trace ring if enabled.
+int32_t
+syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
+{
+	struct SyscallTrace *st = curenv->env_sctrace;
+	struct SyscallTraceRec *rec = 0;
+	struct syscall_stat *ss = 0;
+	uint64_t start = read_tsc();
+	uint32_t cycles;
+	int32_t ret;
+
+	curenv->env_stats.es_syscalls++;
+	if (syscallno < NSYSCALLS) {
+		ss = &syscall_stats[syscallno];
+		ss->ss_calls++;
+	}
+	if (st) {
+		// filled in before dispatching, in case the call doesn't return
+		rec = &st->st_recs[st->st_next++ % SCTRACE_NREC];
+		rec->tr_num = syscallno;
+		rec->tr_args[0] = a1;
+		rec->tr_args[1] = a2;
+		rec->tr_args[2] = a3;
+		rec->tr_args[3] = a4;
+		rec->tr_args[4] = a5;
+		rec->tr_ret = 0;
+		rec->tr_cycles = ~0;
+	}
+
+	ret = syscall_dispatch(syscallno, a1, a2, a3, a4, a5);
+
+	cycles = (uint32_t) (read_tsc() - start);
+	if (ss) {
+		ss->ss_timed++;
+		ss->ss_cycles += cycles;
+		ss->ss_hist[log2_bucket(cycles)]++;
+	}
+	// the environment may have stopped tracing itself, or been freed
+	if (rec && curenv->env_sctrace == st) {
+		rec->tr_ret = ret;
+		rec->tr_cycles = cycles;
+	}
+	return ret;
+}
+
+static const char *
+syscall_name(uint32_t num)
+{
+	if (num < NSYSCALLS && syscall_names[num])
+		return syscall_names[num];
+	return "(unknown)";
+}
+
+// Print the counts and latency histograms of the system calls made.
+void
+syscall_print_stats(void)
+{
+	struct syscall_stat *ss;
+	uint32_t num;
+	int i;
+
+	cprintf("syscall                  calls avg cycles  log2(cycles):count\n");
+	for (num = 0; num < NSYSCALLS; num++) {
+		ss = &syscall_stats[num];
+		if (!ss->ss_calls)
+			continue;
+		cprintf("%-22s %7u %10llu ", syscall_name(num), ss->ss_calls,
+			ss->ss_timed ? ss->ss_cycles / ss->ss_timed : 0);
+		for (i = 0; i < SYSCALL_HIST_BUCKETS; i++)
+			if (ss->ss_hist[i])
+				cprintf(" %d:%u", i, ss->ss_hist[i]);
+		cprintf("\n");
+	}
+}
+
+void
+syscall_reset_stats(void)
+{
+	memset(syscall_stats, 0, sizeof(syscall_stats));
+}
+
+// Start or stop recording envid's system calls in a trace ring.
+int
+syscall_trace(envid_t envid, bool on)
+{
+	struct Env *e;
+	struct Page *pp;
+	int r;
+
+	if ((r = envid2env(envid, &e, 0)) < 0)
+		return r;
+	if (on && !e->env_sctrace) {
+		static_assert(sizeof(struct SyscallTrace) <= PGSIZE);
+		if ((r = page_alloc(&pp)) < 0)
+			return r;
+		pp->pp_ref++;
+		e->env_sctrace = page2kva(pp);
+		memset(e->env_sctrace, 0, sizeof(struct SyscallTrace));
+	} else if (!on && e->env_sctrace)
+		syscall_trace_free(e);
+	return 0;
+}
+
+// Free e's trace ring, if it has one.
+void
+syscall_trace_free(struct Env *e)
+{
+	if (!e->env_sctrace)
+		return;
+	page_decref(pa2page(PADDR(e->env_sctrace)));
+	e->env_sctrace = 0;
+}
+
+// Print the last 'n' system calls in envid's trace ring, oldest first.
+int
+syscall_print_trace(envid_t envid, int n)
+{
+	struct Env *e;
+	struct SyscallTrace *st;
+	struct SyscallTraceRec *rec;
+	uint32_t i;
+	int r;
+
+	if ((r = envid2env(envid, &e, 0)) < 0)
+		return r;
+	if (!(st = e->env_sctrace)) {
+		cprintf("[%08x] is not being traced\n", e->env_id);
+		return 0;
+	}
+	if (n < 0 || n > SCTRACE_NREC)
+		n = SCTRACE_NREC;
+	if (n > st->st_next)
+		n = st->st_next;
+	for (i = st->st_next - n; i != st->st_next; i++) {
+		rec = &st->st_recs[i % SCTRACE_NREC];
+		cprintf("%6u %-22s %08x %08x %08x %08x %08x", i,
+			syscall_name(rec->tr_num), rec->tr_args[0],
+			rec->tr_args[1], rec->tr_args[2], rec->tr_args[3],
+			rec->tr_args[4]);
+		if (rec->tr_cycles == ~0U)
+			cprintf("  (did not return)\n");
+		else if (rec->tr_ret < 0)
+			cprintf(" = %e  %u cycles\n", rec->tr_ret, rec->tr_cycles);
+		else
+			cprintf(" = %d  %u cycles\n", rec->tr_ret, rec->tr_cycles);
+	}
+	return 0;
+}
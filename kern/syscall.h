@@ -5,7 +5,31 @@
 #endif
 
 #include <inc/syscall.h>
+#include <inc/env.h>
+
+// Buckets in the log2 latency histograms: 2^31 cycles and up land in the last
+#define SYSCALL_HIST_BUCKETS	32
+
+// A system call recorded in an environment's trace ring
+struct SyscallTraceRec {
+	uint32_t tr_num;		// system call number
+	uint32_t tr_args[5];
+	int32_t tr_ret;			// return value
+	uint32_t tr_cycles;		// cycles taken, ~0 if it didn't return
+};
+
+// A trace ring, one page per traced environment (see syscall_trace)
+#define SCTRACE_NREC	127
+struct SyscallTrace {
+	uint32_t st_next;		// calls recorded so far
+	struct SyscallTraceRec st_recs[SCTRACE_NREC];
+};
 
 int32_t syscall(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5);
+void syscall_print_stats(void);
+void syscall_reset_stats(void);
+int syscall_trace(envid_t envid, bool on);
+void syscall_trace_free(struct Env *e);
+int syscall_print_trace(envid_t envid, int n);
 
 #endif /* !JOS_KERN_SYSCALL_H */
@@ -1,26 +1,214 @@
 #include <kern/time.h>
+#include <kern/env.h>
+#include <kern/kclock.h>
 #include <inc/assert.h>
+#include <inc/error.h>
 
-static unsigned int ticks;
+// Milliseconds since boot, brought up to date by time_update
+static unsigned int msec;
+// TSC at boot, the origin of msec if the TSC is calibrated
+static uint64_t tsc_boot;
+// Set while the PIT is programmed for a single interrupt (see time_idle)
+static bool idle;
+
+// The clock page, mapped read-only at UTIME for environments
+struct TimePage *timepage;
+
+// Armed timers, in a binary min-heap ordered by deadline.
+// Each environment has at most two armed timers.
+static struct EnvTimer *timer_heap[2 * NENV];
+static int timer_count;
 
 void
 time_init(void) 
 {
-	ticks = 0;
+	msec = 0;
+	tsc_boot = read_tsc();
+	timer_count = 0;
+
+	timepage->tp_seq = 0;
+	timepage->tp_msec = 0;
+	timepage->tp_tsc = tsc_boot;
+	timepage->tp_tsc_khz = tsc_khz;
+	if (tsc_khz)
+		timepage->tp_nsec_mult = (1000000ULL << TIME_MULT_SHIFT) / tsc_khz;
+}
+
+static void
+timer_place(struct EnvTimer *t, int i)
+{
+	timer_heap[i] = t;
+	t->et_heapidx = i;
+}
+
+// Move the timer at index 'i' up or down until the heap is ordered again.
+static void
+timer_sift(int i)
+{
+	struct EnvTimer *t = timer_heap[i];
+	int child;
+
+	while (i > 0 && t->et_deadline < timer_heap[(i - 1) / 2]->et_deadline) {
+		timer_place(timer_heap[(i - 1) / 2], i);
+		i = (i - 1) / 2;
+	}
+	while ((child = 2 * i + 1) < timer_count) {
+		if (child + 1 < timer_count
+		    && timer_heap[child + 1]->et_deadline < timer_heap[child]->et_deadline)
+			child++;
+		if (t->et_deadline <= timer_heap[child]->et_deadline)
+			break;
+		timer_place(timer_heap[child], i);
+		i = child;
+	}
+	timer_place(t, i);
+}
+
+// Arm 't' to fire at time_msec() 'deadline', replacing any earlier deadline.
+void
+timer_arm(struct EnvTimer *t, uint32_t deadline)
+{
+	t->et_deadline = deadline;
+	if (t->et_heapidx < 0) {
+		assert(timer_count < 2 * NENV);
+		t->et_heapidx = timer_count++;
+		timer_heap[t->et_heapidx] = t;
+	}
+	timer_sift(t->et_heapidx);
+}
+
+// Disarm 't' if it is armed.
+void
+timer_cancel(struct EnvTimer *t)
+{
+	int i = t->et_heapidx;
+
+	if (i < 0)
+		return;
+	t->et_heapidx = -1;
+	if (i == --timer_count)
+		return;
+	timer_place(timer_heap[timer_count], i);
+	timer_sift(i);
+}
+
+// Fire the expired timer 't'.
+// An IPC timeout wakes its environment from sys_ipc_recv with -E_TIMEOUT.
+// A sys_timer_set notification is delivered like an IPC from envid 0,
+// or kept for the environment's next sys_ipc_recv if it isn't receiving.
+static void
+timer_fire(struct EnvTimer *t)
+{
+	struct Env *e = &envs[((char *) t - (char *) envs) / sizeof(struct Env)];
+
+	if (t == &e->env_ipc_timeout) {
+		if (!e->env_ipc_recving)
+			return;
+		e->env_ipc_recving = 0;
+		e->env_ipc_from = 0;
+		e->env_ipc_value = 0;
+		e->env_ipc_perm = 0;
+		e->env_tf.tf_regs.reg_eax = -E_TIMEOUT;
+		e->env_status = ENV_RUNNABLE;
+	} else if (e->env_ipc_recving) {
+		timer_cancel(&e->env_ipc_timeout);
+		e->env_ipc_recving = 0;
+		e->env_ipc_from = 0;
+		e->env_ipc_value = t->et_value;
+		e->env_ipc_perm = 0;
+		e->env_status = ENV_RUNNABLE;
+	} else
+		t->et_fired = 1;
+}
+
+// Bring msec and the clock page up to date.  With a calibrated TSC the
+// time comes from the TSC; otherwise each 'tick' of the periodic timer
+// adds TICK_MSEC.
+static void
+time_update(bool tick)
+{
+	unsigned int now;
+	uint64_t tsc;
+
+	if (tsc_khz) {
+		now = (read_tsc() - tsc_boot) / tsc_khz;
+		tsc = tsc_boot + (uint64_t) now * tsc_khz;
+	} else {
+		now = msec + (tick ? TICK_MSEC : 0);
+		tsc = read_tsc();
+	}
+	if (now < msec)
+		panic("time_update: time overflowed");
+	msec = now;
+
+	timepage->tp_seq++;
+	timepage->tp_msec = msec;
+	timepage->tp_tsc = tsc;
+	timepage->tp_seq++;
 }
 
 // this is called once per timer interupt; a timer interupt fires 100 times a
-// second
+// second while environments are running, and only at timer deadlines
+// while the kernel is idle
 void
 time_tick(void) 
 {
-	ticks++;
-	if (ticks * 10 < ticks)
-		panic("time_tick: time overflowed");
+	struct EnvTimer *t;
+
+	time_update(1);
+
+	while (timer_count > 0 && timer_heap[0]->et_deadline <= time_msec()) {
+		t = timer_heap[0];
+		timer_cancel(t);
+		timer_fire(t);
+	}
+}
+
+// Nothing is runnable and the kernel is about to halt: program the PIT
+// to interrupt at the earliest timer deadline rather than every tick.
+// This needs the TSC to keep time between interrupts.
+void
+time_idle(void)
+{
+	unsigned int wait = KCLOCK_ONESHOT_MAX;
+	uint32_t deadline;
+
+	if (!tsc_khz)
+		return;
+	time_update(0);
+	if (timer_count > 0) {
+		deadline = timer_heap[0]->et_deadline;
+		if (deadline <= msec)
+			wait = 0;
+		else if (deadline - msec < wait)
+			wait = deadline - msec;
+	}
+	kclock_oneshot(wait);
+	idle = 1;
+}
+
+// An environment is about to run after the kernel was idle: catch up
+// with the time and go back to ticking every TICK_MSEC, which is also
+// the time slice.
+void
+time_resume(void)
+{
+	if (!idle)
+		return;
+	idle = 0;
+	time_update(0);
+	kclock_periodic();
 }
 
 unsigned int
 time_msec(void) 
 {
-	return ticks * 10;
+	return msec;
+}
+
+// Nanoseconds since boot, to the resolution of the TSC.
+uint64_t
+time_nsec(void)
+{
+	return timepage_nsec(timepage);
 }
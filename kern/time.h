@@ -4,8 +4,18 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/env.h>
+#include <inc/time.h>
+
+extern struct TimePage *timepage;
+
 void time_init(void);
 void time_tick(void); 
 unsigned int time_msec(void);
+uint64_t time_nsec(void);
+void time_idle(void);
+void time_resume(void);
+void timer_arm(struct EnvTimer *t, uint32_t deadline);
+void timer_cancel(struct EnvTimer *t);
 
 #endif /* JOS_KERN_TIME_H */
@@ -12,6 +12,7 @@
 #include <kern/kclock.h>
 #include <kern/picirq.h>
 #include <kern/time.h>
+#include <kern/profile.h>
 #include <kern/e100.h>
 
 extern int vectors[];	// in trapentry.S: array of 256 entry pointers
@@ -61,6 +62,24 @@ static const char *trapname(int trapno)
 }
 
 
+bool sysenter_enabled;
+
+// Point sysenter at sysenter_handler, if the CPU has it.
+static void
+sysenter_init(void)
+{
+	extern void sysenter_handler();
+	uint32_t edx;
+
+	cpuid(1, 0, 0, 0, &edx);
+	if (!(edx & CPUID_FEAT_SEP))
+		return;
+	wrmsr(MSR_SYSENTER_CS, GD_KT);
+	wrmsr(MSR_SYSENTER_ESP, KSTACKTOP);
+	wrmsr(MSR_SYSENTER_EIP, (uint32_t) sysenter_handler);
+	sysenter_enabled = 1;
+}
+
 void
 idt_init(void)
 {
@@ -99,6 +118,8 @@ idt_init(void)
 
 	// Load the IDT
 	asm volatile("lidt idt_pd");
+
+	sysenter_init();
 }
 
 void
@@ -157,12 +178,33 @@ trap_dispatch(struct Trapframe *tf)
 	case IRQ_OFFSET + IRQ_TIMER:
 	// Add time tick increment to clock interrupts.
 	// LAB 6: Your code here.
+		if (curenv)
+			curenv->env_vsys->vs_ticks++;
+		prof_sample(tf);
 		time_tick();
 		sched_yield();
 		return;
 	}
 
 
+	// Handle keyboard and serial interrupts.  Both are unmasked by
+	// cons_init, and may come in while the kernel halts in sched_halt.
+	if (tf->tf_trapno == IRQ_OFFSET + IRQ_KBD) {
+		kbd_intr();
+		return;
+	}
+	if (tf->tf_trapno == IRQ_OFFSET + IRQ_SERIAL) {
+		serial_intr();
+		return;
+	}
+
+	// Handle interrupts from the NIC
+	if (pcircd.irq_line && tf->tf_trapno == IRQ_OFFSET + pcircd.irq_line) {
+		nic_e100_intr();
+		irq_eoi();
+		return;
+	}
+
 	// Handle spurious interupts
 	// The hardware sometimes raises these because of noise on the
 	// IRQ line or other reasons. We don't care.
@@ -194,7 +236,9 @@ trap(struct Trapframe *tf)
 		curenv->env_tf = *tf;
 		// The trapframe on the stack should be ignored from here on.
 		tf = &curenv->env_tf;
-	}
+		env_charge(curenv, ACCT_KERN);
+	} else
+		env_charge(NULL, ACCT_KERN);
 	
 	// Dispatch based on what type of trap occurred
 	trap_dispatch(tf);
@@ -208,6 +252,33 @@ trap(struct Trapframe *tf)
 		sched_yield();
 }
 
+// Handle a system call made with sysenter.
+// The library's sysenter stub treats all registers but esp and ebp as
+// clobbered, so only eip, esp and the return value are saved in
+// curenv->env_tf.  That is enough for env_run to resume the environment
+// if the system call doesn't return to it directly (sys_yield,
+// a blocking sys_ipc_recv).
+int32_t
+sysenter_trap(struct SysenterFrame *sf)
+{
+	struct Trapframe *tf;
+
+	assert(curenv);
+	env_charge(curenv, ACCT_KERN);
+	tf = &curenv->env_tf;
+	tf->tf_eip = sf->sf_eip;
+	tf->tf_esp = sf->sf_esp;
+	tf->tf_trapno = T_SYSCALL;
+	tf->tf_regs.reg_eax = syscall(sf->sf_num, sf->sf_a1, sf->sf_a2,
+				      sf->sf_a3, sf->sf_a4, 0);
+
+	if (curenv->env_status != ENV_RUNNABLE)
+		sched_yield();
+	sf->sf_eflags = tf->tf_eflags & ~FL_IF;
+	// Returning straight to the environment, bypassing env_run
+	env_charge(curenv, ACCT_USER);
+	return tf->tf_regs.reg_eax;
+}
 
 void
 page_fault_handler(struct Trapframe *tf)
@@ -225,6 +296,7 @@ page_fault_handler(struct Trapframe *tf)
 
 	// We've already handled kernel-mode exceptions, so if we get here,
 	// the page fault happened in user mode.
+	curenv->env_stats.es_pgfaults++;
 
 	// Call the environment's page fault upcall, if one exists.  Set up a
 	// page fault stack frame on the user exception stack (below
@@ -12,7 +12,23 @@
 /* The kernel's interrupt descriptor table */
 extern struct Gatedesc idt[];
 
+// The frame sysenter_handler (kern/trapentry.S) builds on the kernel stack
+struct SysenterFrame {
+	uint32_t sf_eip;	// user eip and esp to sysexit to
+	uint32_t sf_esp;
+	uint32_t sf_eflags;	// eflags to sysexit with, set by sysenter_trap
+	uint32_t sf_num;	// system call number
+	uint32_t sf_a1;		// and parameters
+	uint32_t sf_a2;
+	uint32_t sf_a3;
+	uint32_t sf_a4;
+};
+
+// Set if the CPU supports sysenter and the kernel has enabled it
+extern bool sysenter_enabled;
+
 void idt_init(void);
+int32_t sysenter_trap(struct SysenterFrame *sf);
 void print_regs(struct PushRegs *regs);
 void print_trapframe(struct Trapframe *tf);
 void page_fault_handler(struct Trapframe *);
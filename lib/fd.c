@@ -14,6 +14,13 @@
 // Return the file data pointer for file descriptor index i
 #define INDEX2DATA(i)	((char*) (FILEBASE + (i)*PTSIZE))
 
+// File offset mapped at the start of each file descriptor's data area.
+// It describes this environment's mappings of that area, so it lives
+// with them rather than in the Fd page: descriptors made by dup share
+// an Fd page but each slides its own data area, and fork copies this
+// array along with the mappings.  spawn passes no descriptors on.
+static off_t fdwindow[MAXFD];
+
 
 /********************************
  * FILE DESCRIPTOR MANIPULATORS *
@@ -32,6 +39,33 @@ fd2num(struct Fd *fd)
 	return ((uintptr_t) fd - FDTABLE) / PGSIZE;
 }
 
+// Find the file descriptor whose data area contains 'va'.
+// Returns 0 on success, or -E_INVAL if 'va' isn't in any fd's data area
+// or that fd isn't open.
+int
+data2fd(void *va, struct Fd **fd_store)
+{
+	uintptr_t a = (uintptr_t) va;
+
+	if (a < FILEBASE || a >= (uintptr_t) INDEX2DATA(MAXFD))
+		return -E_INVAL;
+	return fd_lookup((a - FILEBASE) / PTSIZE, fd_store);
+}
+
+// Return the file offset that the start of fd's data area maps.
+off_t
+fd2window(struct Fd *fd)
+{
+	return fdwindow[fd2num(fd)];
+}
+
+// Record that fd's data area now maps the file starting at 'offset'.
+void
+fd_set_window(struct Fd *fd, off_t offset)
+{
+	fdwindow[fd2num(fd)] = offset;
+}
+
 // Finds the smallest i from 0 to MAXFD-1 that doesn't have
 // its fd page mapped.
 // Sets *fd_store to the corresponding fd page virtual address.
@@ -183,6 +217,7 @@ dup(int oldfdnum, int newfdnum)
 
 	if ((r = sys_page_map(0, oldfd, 0, newfd, vpt[VPN(oldfd)] & PTE_USER)) < 0)
 		goto err;
+	fdwindow[newfdnum] = fdwindow[oldfdnum];
 	if (vpd[PDX(ova)]) {
 		for (i = 0; i < PTSIZE; i += PGSIZE) {
 			pte = vpt[VPN(ova + i)];
@@ -307,15 +342,15 @@ fstat(int fdnum, struct Stat *stat)
 	return (*dev->dev_stat)(fd, stat);
 }
 
+// Paths name file server files, so ask the file server directly
+// rather than opening the file.
 int
 stat(const char *path, struct Stat *stat)
 {
-	int fd, r;
-
-	if ((fd = open(path, O_RDONLY)) < 0)
-		return fd;
-	r = fstat(fd, stat);
-	close(fd);
-	return r;
+	stat->st_name[0] = 0;
+	stat->st_size = 0;
+	stat->st_isdir = 0;
+	stat->st_dev = &devfile;
+	return fsipc_stat(path, stat);
 }
 
@@ -21,9 +21,20 @@ struct Dev devfile =
 	.dev_trunc =	file_trunc
 };
 
+// File data is mapped through the PTSIZE data area each file descriptor
+// has (see fd2data).  Files larger than that are mapped one FWINSIZE
+// window at a time: the data area holds file bytes
+// [fd2window(fd), fd2window(fd) + FWINSIZE), and fwindow() slides the
+// window when an access falls outside it.
+// Pages of the window are mapped on demand: the first touch of a page
+// faults, and file_pgfault asks the file server for it.
+#define FWINSIZE	PTSIZE
+
 // Helper functions for file access
-static int fmap(struct Fd *fd, off_t oldsize, off_t newsize);
 static int funmap(struct Fd *fd, off_t oldsize, off_t newsize, bool dirty);
+static int fdirty(struct Fd *fd, off_t oldsize, off_t newsize, bool close);
+static int fwindow(struct Fd *fd, off_t offset, char **va);
+static int fpagein(struct Fd *fd, off_t offset, size_t n);
 
 // Open a file (or directory),
 // returning the file descriptor index on success, < 0 on failure.
@@ -36,7 +47,7 @@ open(const char *path, int mode)
 	// (fd_alloc does not allocate a page, it just returns an
 	// unused fd address.  Do you need to allocate a page?  Look
 	// at fsipc.c if you aren't sure.)
-	// Then map the file data (you may find fmap() helpful).
+	// The file data is mapped lazily, by file_pgfault.
 	// Return the file descriptor index.
 	// If any step fails, use fd_close to free the file descriptor.
 
@@ -48,15 +59,10 @@ open(const char *path, int mode)
 		return r;
 	if ((r = sys_page_alloc(0, fd, PTE_P | PTE_U | PTE_W)))
 		return r;
+	pgfault_init();
+	fd_set_window(fd, 0);
 	if ((r = fsipc_open(path, mode, fd)) < 0) {
-		if ((r = fd_close(fd, 1)) < 0)
-			return r;
-		return r;
-	}
-
-	if ((r = fmap(fd, 0, fd->fd_file.file.f_size)) < 0) {
-		if ((r = fd_close(fd, 1)) < 0)
-			return r;
+		fd_close(fd, 0);
 		return r;
 	}
 	return fd2num(fd);
@@ -73,14 +79,12 @@ file_close(struct Fd *fd)
 
 	// LAB 5: Your code here.
 	int r;
-	uint32_t fileid;
 
-	if ((r = funmap(fd, fd->fd_file.file.f_size, 0, 1)) < 0) {
+	// Report dirty pages and close the file in as few round trips
+	// as possible, then drop our mappings.
+	if ((r = fdirty(fd, fd->fd_file.file.f_size, 0, 1)) < 0)
 		return r;
-	}
-	
-	fileid = fd->fd_file.id;
-	if ((r = fsipc_close(fileid)) < 0)
+	if ((r = funmap(fd, fd->fd_file.file.f_size, 0, 0)) < 0)
 		return r;
 
 	//if ((r = fd_close(fd, 1)) < 0)
@@ -95,7 +99,9 @@ file_close(struct Fd *fd)
 static ssize_t
 file_read(struct Fd *fd, void *buf, size_t n, off_t offset)
 {
-	size_t size;
+	int r;
+	size_t size, tot, m;
+	char *va;
 
 	// avoid reading past the end of file
 	size = fd->fd_file.file.f_size;
@@ -104,8 +110,16 @@ file_read(struct Fd *fd, void *buf, size_t n, off_t offset)
 	if (offset + n > size)
 		n = size - offset;
 
-	// read the data by copying from the file mapping
-	memmove(buf, fd2data(fd) + offset, n);
+	// read the data by copying from the file mapping,
+	// one window at a time
+	for (tot = 0; tot < n; tot += m) {
+		if ((r = fwindow(fd, offset + tot, &va)) < 0)
+			return r;
+		m = MIN(n - tot, FWINSIZE - (offset + tot) % FWINSIZE);
+		if ((r = fpagein(fd, offset + tot, m)) < 0)
+			return r;
+		memmove((char *) buf + tot, va, m);
+	}
 	return n;
 }
 
@@ -122,11 +136,15 @@ read_map(int fdnum, off_t offset, void **blk)
 		return r;
 	if (fd->fd_dev_id != devfile.dev_id)
 		return -E_INVAL;
-	va = fd2data(fd) + offset;
 	if (offset >= MAXFILESIZE)
 		return -E_NO_DISK;
-	if (!(vpd[PDX(va)] & PTE_P) || !(vpt[VPN(va)] & PTE_P))
+	if (ROUNDDOWN(offset, PGSIZE) >= fd->fd_file.file.f_size)
 		return -E_NO_DISK;
+	// Fetch the page rather than fault it in: the caller may
+	// hand it to a system call.
+	if ((r = fwindow(fd, offset, &va)) < 0
+	    || (r = fpagein(fd, offset, 1)) < 0)
+		return r;
 	*blk = (void*) va;
 	return 0;
 }
@@ -136,7 +154,8 @@ static ssize_t
 file_write(struct Fd *fd, const void *buf, size_t n, off_t offset)
 {
 	int r;
-	size_t tot;
+	size_t tot, m;
+	char *va;
 
 	// don't write past the maximum file size
 	tot = offset + n;
@@ -149,8 +168,15 @@ file_write(struct Fd *fd, const void *buf, size_t n, off_t offset)
 			return r;
 	}
 
-	// write the data
-	memmove(fd2data(fd) + offset, buf, n);
+	// write the data, one window at a time
+	for (tot = 0; tot < n; tot += m) {
+		if ((r = fwindow(fd, offset + tot, &va)) < 0)
+			return r;
+		m = MIN(n - tot, FWINSIZE - (offset + tot) % FWINSIZE);
+		if ((r = fpagein(fd, offset + tot, m)) < 0)
+			return r;
+		memmove(va, (const char *) buf + tot, m);
+	}
 	return n;
 }
 
@@ -180,52 +206,44 @@ file_trunc(struct Fd *fd, off_t newsize)
 		return r;
 	assert(fd->fd_file.file.f_size == newsize);
 
-	if ((r = fmap(fd, oldsize, newsize)) < 0)
-		return r;
+	// New pages get mapped when they are first touched.
 	funmap(fd, oldsize, newsize, 0);
 
 	return 0;
 }
 
-// Call the file system server to obtain and map file pages
-// when the size of the file as mapped in our memory increases.
-// Harmlessly does nothing if oldsize >= newsize.
-// Returns 0 on success, < 0 on error.
-// If there is an error, unmaps any newly allocated pages.
-//
-// Hint: Use fd2data to get the start of the file mapping area for fd.
-// Hint: You can use ROUNDUP to page-align offsets.
-static int
-fmap(struct Fd* fd, off_t oldsize, off_t newsize)
+// Handle a page fault at an unmapped page of a file descriptor's data
+// area by mapping the file block there.
+// Returns 1 if the fault was handled, 0 if it isn't ours or the file
+// server couldn't map the block.  The library's own accesses map their
+// pages with fpagein first, so that errors reach the caller; this only
+// catches programs touching the data area directly.
+int
+file_pgfault(struct UTrapframe *utf)
 {
-	// LAB 5: Your code here.
-	char *data;
-	off_t offset, u_off;
-	uint32_t fileid;
+	struct Fd *fd;
+	char *va;
+	off_t offset;
 	int r;
 
-	if (oldsize >= newsize)
+	va = ROUNDDOWN((char *) utf->utf_fault_va, PGSIZE);
+	if (data2fd(va, &fd) < 0 || fd->fd_dev_id != devfile.dev_id)
 		return 0;
-
-	data = fd2data(fd);
-	fileid = fd->fd_file.id;
-
-	for (offset = ROUNDUP(oldsize, PGSIZE); offset < ROUNDUP(newsize, PGSIZE); offset += PGSIZE) {
-
-		if ((r = fsipc_map(fileid, offset, (void *)(data + offset))) < 0) {
-			// map fails, unmap the previously mapped pages
-			for (u_off = ROUNDUP(oldsize, PGSIZE); u_off < offset; u_off += PGSIZE) {
-				if ((r = sys_page_unmap(0, (void *)(data + u_off))) < 0)
-					return r;
-			}
-			return r;
-		}
-	}
-	return 0;
+	// A fault on a page that is present (say, a write to a read-only
+	// mapping) is a real fault.
+	if ((vpd[PDX(va)] & PTE_P) && (vpt[VPN(va)] & PTE_P))
+		return 0;
+	offset = fd2window(fd) + (va - fd2data(fd));
+	if (offset >= fd->fd_file.file.f_size)
+		return 0;
+	if ((r = fsipc_map(fd->fd_file.id, offset, va)) < 0)
+		return 0;
+	return 1;
 }
 
 // Unmap any file pages that no longer represent valid file pages
 // when the size of the file as mapped in our address space decreases.
+// Only pages inside the current window can be mapped.
 // Harmlessly does nothing if newsize >= oldsize.
 //
 // Hint: Remember to call fsipc_dirty if dirty is true and PTE_D bit
@@ -236,24 +254,112 @@ static int
 funmap(struct Fd* fd, off_t oldsize, off_t newsize, bool dirty)
 {
 	// LAB 5: Your code here.
-	char *data;
-	off_t offset, u_off;
-	uint32_t fileid;
+	char *data, *va;
+	off_t win, start, end, offset;
 	int r;
 
 	if (newsize >= oldsize)
 		return 0;
 
+	if (dirty && (r = fdirty(fd, oldsize, newsize, 0)) < 0)
+		return r;
+
 	data = fd2data(fd);
-	fileid = fd->fd_file.id;
+	win = fd2window(fd);
+
+	start = MAX(ROUNDUP(newsize, PGSIZE), win);
+	end = MIN(ROUNDUP(oldsize, PGSIZE), win + FWINSIZE);
+	for (offset = start; offset < end; offset += PGSIZE) {
+		// Pages that were never touched were never mapped.
+		va = data + offset - win;
+		if (!(vpd[PDX(va)] & PTE_P) || !(vpt[VPN(va)] & PTE_P))
+			continue;
+		if ((r = sys_page_unmap(0, va)) < 0)
+			return r;
+	}
+	return 0;
+}
+
+// Tell the file server which of the pages of fd's window that map
+// [newsize, oldsize) we have dirtied, batching FSBATCH_NENT - 1 pages
+// per round trip.  If 'close' is set, close the file with the last batch.
+// Returns 0 on success, < 0 on error.
+static int
+fdirty(struct Fd *fd, off_t oldsize, off_t newsize, bool close)
+{
+	off_t offsets[FSBATCH_NENT - 1];
+	char *data, *va;
+	off_t win, start, end, offset;
+	uint32_t fileid;
+	int n, r;
 
-	for (offset = ROUNDUP(newsize, PGSIZE); offset < ROUNDUP(oldsize, PGSIZE); offset += PGSIZE) {
+	data = fd2data(fd);
+	win = fd2window(fd);
+	fileid = fd->fd_file.id;
 
-		if (dirty && (vpt[VPN(data+offset)] & PTE_D)) {
-			if ((r = fsipc_dirty(fileid, (off_t)(data + offset))) < 0)
+	n = 0;
+	start = MAX(ROUNDUP(newsize, PGSIZE), win);
+	end = MIN(ROUNDUP(oldsize, PGSIZE), win + FWINSIZE);
+	for (offset = start; offset < end; offset += PGSIZE) {
+		va = data + offset - win;
+		if (!(vpd[PDX(va)] & PTE_P) || !(vpt[VPN(va)] & PTE_P)
+		    || !(vpt[VPN(va)] & PTE_D))
+			continue;
+		offsets[n++] = offset;
+		if (n == FSBATCH_NENT - 1) {
+			if ((r = fsipc_dirty_close(fileid, offsets, n, 0)) < 0)
 				return r;
+			n = 0;
 		}
-		if ((r = sys_page_unmap(0, (void *)(data + offset))) < 0)
+	}
+	if (n > 0 || close)
+		return fsipc_dirty_close(fileid, offsets, n, close);
+	return 0;
+}
+
+// Make sure the window of file data mapped at fd2data(fd) includes
+// 'offset', sliding it if necessary, and set *va to the address at which
+// 'offset' is mapped.
+// Returns 0 on success, < 0 on error.
+static int
+fwindow(struct Fd *fd, off_t offset, char **va)
+{
+	int r;
+	off_t win, size;
+
+	// The fd may have been inherited from an environment that
+	// set up the fault handler, rather than opened here.
+	pgfault_init();
+
+	win = fd2window(fd);
+	if (offset < win || offset >= win + FWINSIZE) {
+		size = fd->fd_file.file.f_size;
+		if ((r = funmap(fd, size, 0, 1)) < 0)
+			return r;
+		win = ROUNDDOWN(offset, FWINSIZE);
+		fd_set_window(fd, win);
+	}
+	*va = fd2data(fd) + (offset - win);
+	return 0;
+}
+
+// Map the pages holding file bytes [offset, offset + n) that haven't
+// been touched yet.  The range must lie within fd's current window.
+// Returns 0 on success, < 0 on error, such as running out of disk
+// for a file that was just extended.
+static int
+fpagein(struct Fd *fd, off_t offset, size_t n)
+{
+	off_t win, pgoff;
+	char *va;
+	int r;
+
+	win = fd2window(fd);
+	for (pgoff = ROUNDDOWN(offset, PGSIZE); pgoff < offset + n; pgoff += PGSIZE) {
+		va = fd2data(fd) + (pgoff - win);
+		if ((vpd[PDX(va)] & PTE_P) && (vpt[VPN(va)] & PTE_P))
+			continue;
+		if ((r = fsipc_map(fd->fd_file.id, pgoff, va)) < 0)
 			return r;
 	}
 	return 0;
@@ -266,6 +372,17 @@ remove(const char *path)
 	return fsipc_remove(path);
 }
 
+// Read the entries of directory 'path' into 'buf', which is 'n' bytes
+// long, as a sequence of 'struct Fsdirent's (see inc/fs.h).
+// Start at directory position *pos (0 for the beginning), and advance it.
+// Returns the number of bytes read, 0 at the end of the directory,
+// or < 0 on error.
+int
+readdir(const char *path, uint32_t *pos, void *buf, size_t n)
+{
+	return fsipc_readdir(path, pos, buf, n);
+}
+
 // Synchronize disk with buffer cache
 int
 sync(void)
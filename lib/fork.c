@@ -128,7 +128,7 @@ fork(void)
 		if ((r = sys_env_set_status(cid, ENV_RUNNABLE)) < 0)
 			panic("sys_env_set_status: %e", r);
 	} else if (cid == 0) {
-		env = &envs[ENVX(sys_getenvid())];
+		env = &envs[ENVX(vsys.vs_envid)];
 	}
 
 	return cid;
@@ -4,6 +4,7 @@
 #define debug 0
 
 extern uint8_t fsipcbuf[PGSIZE];	// page-aligned, declared in entry.S
+extern uint8_t fsmapbuf[PGSIZE];	// page-aligned, declared in entry.S
 
 // Send an IP request to the file server, and wait for a reply.
 // type: request code, passed as the simple integer IPC value.
@@ -47,6 +48,9 @@ fsipc_open(const char *path, int omode, struct Fd *fd)
 // Make a map-block request to the file server.
 // We send the fileid and the (byte) offset of the desired block in the file,
 // and the server sends us back a mapping for a page containing that block.
+// The request is built in fsmapbuf rather than fsipcbuf, because this is
+// called from the page fault handler, possibly while another request is
+// half-built in fsipcbuf.
 // Returns 0 on success, < 0 on failure.
 int
 fsipc_map(int fileid, off_t offset, void *dstva)
@@ -55,7 +59,7 @@ fsipc_map(int fileid, off_t offset, void *dstva)
 	int perm;
 	struct Fsreq_map *req;
 
-	req = (struct Fsreq_map*) fsipcbuf;
+	req = (struct Fsreq_map*) fsmapbuf;
 	req->req_fileid = fileid;
 	req->req_offset = offset;
 	int r= fsipc(FSREQ_MAP, req, dstva, &perm);
@@ -112,6 +116,51 @@ fsipc_remove(const char *path)
 	return fsipc(FSREQ_REMOVE, req, 0, 0);
 }
 
+// Ask the file server for the name, size and type of the file at 'path',
+// without opening it.
+int
+fsipc_stat(const char *path, struct Stat *st)
+{
+	int r;
+	struct Fsreq_stat *req;
+
+	req = (struct Fsreq_stat*) fsipcbuf;
+	if (strlen(path) >= MAXPATHLEN)
+		return -E_BAD_PATH;
+	strcpy(req->req_path, path);
+	if ((r = fsipc(FSREQ_STAT, req, 0, 0)) < 0)
+		return r;
+	strcpy(st->st_name, req->ret_name);
+	st->st_size = req->ret_size;
+	st->st_isdir = req->ret_isdir;
+	return 0;
+}
+
+// Ask the file server for the entries of directory 'path', starting at
+// directory position *pos, without opening it.
+// Packs as many 'struct Fsdirent's as fit into the 'n' bytes at 'buf'
+// and advances *pos past them.
+// Returns the number of bytes used, 0 at the end of the directory,
+// or < 0 on failure.
+int
+fsipc_readdir(const char *path, uint32_t *pos, void *buf, size_t n)
+{
+	int r;
+	struct Fsreq_readdir *req;
+
+	req = (struct Fsreq_readdir*) fsipcbuf;
+	if (strlen(path) >= MAXPATHLEN)
+		return -E_BAD_PATH;
+	strcpy(req->req_path, path);
+	req->req_pos = *pos;
+	req->req_len = MIN(n, sizeof(req->ret_buf));
+	if ((r = fsipc(FSREQ_READDIR, req, 0, 0)) < 0)
+		return r;
+	memmove(buf, req->ret_buf, r);
+	*pos = req->ret_pos;
+	return r;
+}
+
 // Ask the file server to update the disk
 // by writing any dirty blocks in the buffer cache.
 int
@@ -120,3 +169,49 @@ fsipc_sync(void)
 	return fsipc(FSREQ_SYNC, fsipcbuf, 0, 0);
 }
 
+
+// Send the batch of requests in fsipcbuf to the file server,
+// and wait for a reply.
+// Pages the server sends back are mapped into the area of 'npages'
+// pages at 'dstva' (see FSREQ_BATCH in inc/fs.h).
+// Returns 0 if all the requests succeeded, < 0 on the first failure.
+static int
+fsipc_batch(void *dstva, size_t npages)
+{
+	envid_t whom;
+
+	if (debug)
+		cprintf("[%08x] fsipc batch %d\n", env->env_id,
+			((struct Fsreq_batch*)fsipcbuf)->req_n);
+
+	ipc_send(envs[1].env_id, FSREQ_BATCH, fsipcbuf, PTE_P | PTE_W | PTE_U);
+	return ipc_recv_pages(&whom, dstva, npages, 0);
+}
+
+// Tell the file server that the file blocks at the 'n' offsets in
+// 'offsets' are dirty, and then, if 'close' is set, close the file,
+// all in a single round trip.
+// 'n' may be at most FSBATCH_NENT - 1.
+int
+fsipc_dirty_close(int fileid, const off_t *offsets, int n, bool close)
+{
+	int i;
+	struct Fsreq_batch *req;
+
+	if (n < 0 || n > FSBATCH_NENT - 1)
+		return -E_INVAL;
+
+	req = (struct Fsreq_batch*)fsipcbuf;
+	for (i = 0; i < n; i++) {
+		req->req_ent[i].be_type = FSREQ_DIRTY;
+		req->req_ent[i].be_fileid = fileid;
+		req->req_ent[i].be_offset = offsets[i];
+	}
+	if (close) {
+		req->req_ent[i].be_type = FSREQ_CLOSE;
+		req->req_ent[i].be_fileid = fileid;
+		i++;
+	}
+	req->req_n = i;
+	return fsipc_batch(0, 0);
+}
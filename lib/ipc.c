@@ -18,16 +18,33 @@
 //   as meaning "no page".  (Zero is not the right value.)
 int32_t
 ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
+{
+	return ipc_recv_pages(from_env_store, pg, 1, perm_store);
+}
+
+// Like ipc_recv, but accept up to 'npages' pages, mapped in the area
+// starting at 'pg', from a sender using ipc_send_pages.
+int32_t
+ipc_recv_pages(envid_t *from_env_store, void *pg, size_t npages, int *perm_store)
+{
+	return ipc_recv_timeout(from_env_store, pg, npages, perm_store, ~0U);
+}
+
+// Like ipc_recv_pages, but return -E_TIMEOUT if nothing has arrived
+// by time_msec() 'deadline'.  A deadline of ~0 waits forever.
+int32_t
+ipc_recv_timeout(envid_t *from_env_store, void *pg, size_t npages,
+		 int *perm_store, unsigned int deadline)
 {
 	// LAB 4: Your code here.
 	int err;
 	void *addr;
-	env = &envs[ENVX(sys_getenvid())];
+	env = &envs[ENVX(vsys.vs_envid)];
 
 	if (pg == NULL) addr = (void *)UTOP;
 	else	addr = pg;
 
-	if ((err = sys_ipc_recv(addr)) < 0) {
+	if ((err = sys_ipc_recv_timeout(addr, npages, deadline)) < 0) {
 		if (from_env_store != NULL) *from_env_store = 0;
 		if (perm_store != NULL)	*perm_store = 0;
 		return err;
@@ -68,3 +85,22 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
 			return;
 	}
 }
+
+// Like ipc_send, but send the 'n' pages described by 'pgs'
+// to a receiver using ipc_recv_pages.  If the receiver can't get
+// the page tables to map them, wait for memory to be freed.
+void
+ipc_send_pages(envid_t to_env, uint32_t val, struct IpcPage *pgs, size_t n)
+{
+	int err;
+
+	while (1) {
+		err = sys_ipc_try_send_pages(to_env, val, pgs, n);
+		if (err == -E_IPC_NOT_RECV || err == -E_NO_MEM)
+			sys_yield();
+		else if (err < 0)
+			panic("sys_ipc_try_send_pages returned with error: %e", err);
+		else
+			return;
+	}
+}
@@ -1,5 +1,5 @@
 // Called from entry.S to get us going.
-// entry.S already took care of defining envs, pages, vpd, and vpt.
+// entry.S already took care of defining envs, pages, vsys, vpd, and vpt.
 
 #include <inc/lib.h>
 
@@ -13,7 +13,7 @@ libmain(int argc, char **argv)
 {
 	// set env to point at our env structure in envs[].
 	// LAB 3: Your code here.
-	env = &envs[ENVX(sys_getenvid())];
+	env = &envs[ENVX(vsys.vs_envid)];
 
 	// save the name of the program so that panic() can use it
 	if (argc > 0)
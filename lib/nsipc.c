@@ -143,6 +143,31 @@ nsipc_send(int s, const void *dataptr, int size, unsigned int flags)
 	return nsipc(NSREQ_SEND, req, 0, &perm);
 }
 
+// Send 'size' bytes starting 'offset' bytes into the page 'pg' by
+// lending the page itself to the network server, without copying it.
+int
+nsipc_sendpage(int s, const void *pg, int offset, int size, unsigned int flags)
+{
+	envid_t whom;
+	struct Nsreq_sendpage *req;
+	struct IpcPage pgs[2];
+
+	req = (struct Nsreq_sendpage*)nsipcbuf;
+	req->req_s = s;
+	req->req_offset = offset;
+	req->req_size = size;
+	req->req_flags = flags;
+
+	pgs[0].ip_srcva = req;
+	pgs[0].ip_dstpg = 0;
+	pgs[0].ip_perm = PTE_P|PTE_W|PTE_U;
+	pgs[1].ip_srcva = (void *) pg;
+	pgs[1].ip_dstpg = 1;
+	pgs[1].ip_perm = PTE_P|PTE_U;
+	ipc_send_pages(envs[2].env_id, NSREQ_SENDPAGE, pgs, 2);
+	return ipc_recv(&whom, 0, 0);
+}
+
 int
 nsipc_socket(int domain, int type, int protocol)
 {
@@ -8,32 +8,56 @@
 // Assembly language pgfault entrypoint defined in lib/pgfaultentry.S.
 extern void _pgfault_upcall(void);
 
-// Pointer to currently installed C-language pgfault handler.
+// Pointer to the C-language pgfault handler called by _pgfault_upcall.
+// Once installed, this is always pgfault_dispatch.
 void (*_pgfault_handler)(struct UTrapframe *utf);
 
+// The handler set by set_pgfault_handler, if any.
+static void (*pgfault_user)(struct UTrapframe *utf);
+
+// Give the library a chance to handle faults in memory it manages itself
+// (file data, see file_pgfault), then pass the rest to the user's handler.
+static void
+pgfault_dispatch(struct UTrapframe *utf)
+{
+	if (file_pgfault(utf))
+		return;
+	if (pgfault_user == 0)
+		panic("unhandled page fault va %08x ip %08x",
+		      utf->utf_fault_va, utf->utf_eip);
+	pgfault_user(utf);
+}
+
 //
-// Set the page fault handler function.
-// If there isn't one yet, _pgfault_handler will be 0.
-// The first time we register a handler, we need to 
+// Make sure the page fault upcall is set up.
+// If it isn't yet, _pgfault_handler will be 0.
+// The first time through, we need to
 // allocate an exception stack (one page of memory with its top
 // at UXSTACKTOP), and tell the kernel to call the assembly-language
 // _pgfault_upcall routine when a page fault occurs.
 //
 void
-set_pgfault_handler(void (*handler)(struct UTrapframe *utf))
+pgfault_init(void)
 {
-	int r;
-
 	if (_pgfault_handler == 0) {
 		// First time through!
 		// LAB 4: Your code here.
 		envid_t id;
-		id = sys_getenvid();
+		id = vsys.vs_envid;
 		sys_page_alloc(id, (void*) (UXSTACKTOP - PGSIZE), PTE_P|PTE_U|PTE_W);
 		sys_env_set_pgfault_upcall(id, _pgfault_upcall);
 	}
 
-	// Save handler pointer for assembly to call.
-	_pgfault_handler = handler;
+	_pgfault_handler = pgfault_dispatch;
+}
+
+//
+// Set the page fault handler function.
+//
+void
+set_pgfault_handler(void (*handler)(struct UTrapframe *utf))
+{
+	pgfault_init();
+	pgfault_user = handler;
 }
 
@@ -49,6 +49,28 @@ send(int s, const void *dataptr, int size, unsigned int flags)
 	return nsipc_send(s, dataptr, size, flags);
 }
 
+// Send 'len' bytes of file 'fd', starting at 'offset', on socket 's'.
+// The file server's pages are passed straight to the network server,
+// so the data is never copied in user space.
+// Returns the number of bytes sent, or < 0 on error.
+int
+sendfile(int s, int fd, off_t offset, size_t len)
+{
+	int r, n;
+	size_t tot;
+	void *blk;
+
+	for (tot = 0; tot < len; tot += n) {
+		if ((r = read_map(fd, ROUNDDOWN(offset + tot, PGSIZE), &blk)) < 0)
+			return tot ? tot : r;
+		n = MIN(len - tot, PGSIZE - (offset + tot) % PGSIZE);
+		if ((r = nsipc_sendpage(s, blk, (offset + tot) % PGSIZE, n,
+					tot + n < len ? MSG_MORE : 0)) < 0)
+			return tot ? tot : r;
+	}
+	return tot;
+}
+
 int
 socket(int domain, int type, int protocol)
 {
@@ -7,6 +7,23 @@ static inline int32_t
 syscall(int num, int check, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
 {
 	int32_t ret;
+	uint32_t dx, cx, bx, di;
+
+	// Fast system call: the same registers, but enter the kernel with
+	// sysenter, passing the address to return to in SI and the stack
+	// pointer in BP.  This leaves no room for a fifth parameter.
+	// The kernel only preserves SP and BP (see sysenter_trap).
+	if (a5 == 0 && (vsys.vs_flags & VSYS_SYSENTER)) {
+		asm volatile("pushl %%ebp\n\t"
+			     "movl %%esp, %%ebp\n\t"
+			     "leal 1f, %%esi\n\t"
+			     "sysenter\n"
+			     "1:\tpopl %%ebp"
+			     : "=a" (ret), "=d" (dx), "=c" (cx), "=b" (bx), "=D" (di)
+			     : "0" (num), "1" (a1), "2" (a2), "3" (a3), "4" (a4)
+			     : "esi", "cc", "memory");
+		goto done;
+	}
 
 	// Generic system call: pass system call number in AX,
 	// up to five parameters in DX, CX, BX, DI, SI.
@@ -30,7 +47,8 @@ syscall(int num, int check, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 		  "D" (a4),
 		  "S" (a5)
 		: "cc", "memory");
-	
+
+done:
 	if(check && ret > 0)
 		panic("syscall %d returned %d (> 0)", num, ret);
 
@@ -111,12 +129,24 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, int perm)
 	return syscall(SYS_ipc_try_send, 0, envid, value, (uint32_t) srcva, perm, 0);
 }
 
+int
+sys_ipc_try_send_pages(envid_t envid, uint32_t value, struct IpcPage *pgs, size_t n)
+{
+	return syscall(SYS_ipc_try_send_pages, 0, envid, value, (uint32_t) pgs, n, 0);
+}
+
 int
 sys_ipc_recv(void *dstva)
 {
 	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 0, 0, 0);
 }
 
+int
+sys_ipc_recv_pages(void *dstva, size_t npages)
+{
+	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, npages, 0, 0, 0);
+}
+
 unsigned int
 sys_time_msec(void)
 {
@@ -134,3 +164,66 @@ sys_receive_packet(void *va)
 {
 	return syscall(SYS_receive_packet, 0, (uint32_t)va, 0, 0, 0, 0);
 }
+
+int
+sys_receive_wait(void)
+{
+	return syscall(SYS_receive_wait, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_transmit_wait(void)
+{
+	return syscall(SYS_transmit_wait, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_receive_pages(void *va, uint32_t n)
+{
+	return syscall(SYS_receive_pages, 0, (uint32_t)va, n, 0, 0, 0);
+}
+
+int
+sys_transmit_packets(const struct TxPkt *pkts, uint32_t n)
+{
+	return syscall(SYS_transmit_packets, 0, (uint32_t)pkts, n, 0, 0, 0);
+}
+
+int
+sys_ipc_recv_timeout(void *dstva, size_t npages, unsigned int deadline)
+{
+	return syscall(SYS_ipc_recv_timeout, 0, (uint32_t)dstva, npages, deadline, 0, 0);
+}
+
+int
+sys_timer_set(envid_t envid, unsigned int deadline, uint32_t value)
+{
+	return syscall(SYS_timer_set, 0, envid, deadline, value, 0, 0);
+}
+
+unsigned int
+sys_time_usec(void)
+{
+	return (unsigned int) syscall(SYS_time_usec, 0, 0, 0, 0, 0, 0);
+}
+
+uint64_t
+sys_time_nsec(void)
+{
+	uint64_t nsec;
+
+	syscall(SYS_time_nsec, 1, (uint32_t)&nsec, 0, 0, 0, 0);
+	return nsec;
+}
+
+int
+sys_env_stats(envid_t envid, struct EnvStats *stats)
+{
+	return syscall(SYS_env_stats, 1, envid, (uint32_t)stats, 0, 0, 0);
+}
+
+int
+sys_env_perf(envid_t envid, struct EnvPerf *perf)
+{
+	return syscall(SYS_env_perf, 0, envid, (uint32_t)perf, 0, 0, 0);
+}
@@ -0,0 +1,25 @@
+// Reading the kernel clock at UTIME without a system call.
+
+#include <inc/lib.h>
+
+// Return milliseconds since boot, like sys_time_msec.
+unsigned int
+time_msec(void)
+{
+	return timepage.tp_msec;
+}
+
+// Return nanoseconds since boot.
+uint64_t
+time_nsec(void)
+{
+	return timepage_nsec(&timepage);
+}
+
+// Return microseconds since boot.
+// The value wraps around about every 71 minutes.
+unsigned int
+time_usec(void)
+{
+	return (unsigned int) (time_nsec() / 1000);
+}
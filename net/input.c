@@ -12,33 +12,31 @@ input(envid_t ns_envid)
 	// 	- read a packet from the device driver
 	//	- send it to the network server
 	
-	struct jif_pkt *pkt = (struct jif_pkt *)PKTMAP;
-	int pktlen, r;
+	void *pg = (void *)PKTMAP;
+	struct IpcPage pgs[NSREQ_NPAGES];
+	int i, n;
 
 	cprintf("Hey, I am INPUT, %x\n", sys_getenvid());
 
+	for (i = 0; i < NSREQ_NPAGES; i++) {
+		pgs[i].ip_srcva = (char *) pg + i * PGSIZE;
+		pgs[i].ip_dstpg = i;
+		pgs[i].ip_perm = PTE_P|PTE_U|PTE_W;
+	}
 
-	// We POLL here
 	while (1) {
-		if ((r = sys_page_alloc(0, pkt, PTE_U|PTE_P|PTE_W)) < 0)
-			panic("[%x]:Sys_page_alloc failed in Input env!", sys_getenvid());
-
-		pktlen = sys_receive_packet(pkt->jp_data);
-		pkt->jp_len = pktlen;
+		// Take the pages the NIC received packets into,
+		// rather than copying them out, as many as have arrived
+		n = sys_receive_pages(pg, NSREQ_NPAGES);
 
-		if (pktlen < 0) {
+		if (n < 0) {
 			cprintf("INPUT: Error in receiving packets\n");
-		} else if (pktlen == 0) {
-			// Still do not have packets yet, give out the CPU
-			// and wait for the next opportunity to get the packet
 			sys_yield();
-		} else if (pktlen > 0) {
-			cprintf("INPUT: PACKET RECEIVED: Len = %d\n", pktlen);
-			ipc_send(ns_envid, NSREQ_INPUT, pkt, PTE_P|PTE_U|PTE_W);
-		}
-
-		if ((r = sys_page_unmap(0, pkt)) < 0)
-			panic("[%x]:Sys_page_unmap failed in Input env!", sys_getenvid());
+		} else if (n == 0) {
+			// No packet yet, sleep until the NIC interrupts
+			sys_receive_wait();
+		} else
+			ipc_send_pages(ns_envid, NSREQ_INPUT, pgs, n);
 	}
 
 }
@@ -399,6 +399,9 @@ pbuf_header(struct pbuf *p, s16_t header_size_increment)
     if ((header_size_increment < 0) && (increment_magnitude <= p->len)) {
       /* increase payload pointer */
       p->payload = (u8_t *)p->payload - header_size_increment;
+    } else if ((type == PBUF_ROM) && PBUF_ROM_CAN_GROW(p, header_size_increment)) {
+      /* the port knows the memory in front of the payload is ours */
+      p->payload = (u8_t *)p->payload - header_size_increment;
     } else {
       /* cannot expand payload to front (yet!)
        * bail out unsuccesfully */
@@ -500,6 +503,9 @@ pbuf_free(struct pbuf *p)
         memp_free(MEMP_PBUF_POOL, p);
       /* is this a ROM or RAM referencing pbuf? */
       } else if (type == PBUF_ROM || type == PBUF_REF) {
+        if (type == PBUF_ROM) {
+          PBUF_ROM_PUT(p);
+        }
         memp_free(MEMP_PBUF, p);
       /* type == PBUF_RAM */
       } else {
@@ -252,6 +252,7 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
       ++queuelen;
       /* reference the non-volatile payload data */
       p->payload = ptr;
+      PBUF_ROM_TAKE(p);
       seg->dataptr = ptr;
 
       /* Second, allocate a pbuf for the headers. */
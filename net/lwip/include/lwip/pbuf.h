@@ -95,6 +95,20 @@ struct pbuf {
   
 };
 
+/** Hooks called when a PBUF_ROM pbuf starts and stops referring to its
+ * payload, so that the port can keep the payload alive. */
+#ifndef PBUF_ROM_TAKE
+#define PBUF_ROM_TAKE(p)
+#endif
+#ifndef PBUF_ROM_PUT
+#define PBUF_ROM_PUT(p)
+#endif
+/** May the payload of PBUF_ROM pbuf p be grown n bytes to the front
+ * (to reveal a header hidden earlier)? */
+#ifndef PBUF_ROM_CAN_GROW
+#define PBUF_ROM_CAN_GROW(p, n) 0
+#endif
+
 /* Initializes the pbuf module. This call is empty for now, but may not be in future. */
 #define pbuf_init()
 
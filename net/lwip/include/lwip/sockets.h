@@ -133,6 +133,7 @@ struct linger {
 #define MSG_OOB        0x04    /* Unimplemented: Requests out-of-band data. The significance and semantics of out-of-band data are protocol-specific */
 #define MSG_DONTWAIT   0x08    /* Nonblocking i/o for this operation only */
 #define MSG_MORE       0x10    /* Sender will send more */
+#define MSG_NOCOPY     0x20    /* JOS: data stays valid until acknowledged, so refer to it rather than copying it */
 
 
 /*
@@ -0,0 +1,108 @@
+#include <inc/lib.h>
+
+#include <arch/thread.h>
+#include <arch/refpage.h>
+
+static uint32_t refcnt[NREFPAGE];
+static bool rxpage[NREFPAGE];	// slot holds a received packet
+static volatile uint32_t nfree = NREFPAGE;
+static uint32_t nrx;		// slots with rxpage set
+
+// Returns the pool slot containing 'addr', or -1 if it isn't in the pool.
+static int
+refpage_slot(void *addr) {
+    uintptr_t a = (uintptr_t) addr;
+
+    if (a < REFPAGE_BASE || a >= REFPAGE_BASE + NREFPAGE * PGSIZE)
+	return -1;
+    return (a - REFPAGE_BASE) / PGSIZE;
+}
+
+// Move the page mapped at 'va' into the pool, mapped with 'perm', and
+// return its new address, or 0 if the pool is full.  The caller holds
+// one reference, which it must drop with refpage_put.
+static void *
+refpage_trylend(void *va, int perm, bool rx) {
+    int i, r;
+    void *pg;
+
+    if (nfree == 0 || (rx && nrx == NREFPAGE_RX))
+	return 0;
+
+    for (i = 0; i < NREFPAGE; i++)
+	if (refcnt[i] == 0)
+	    break;
+    assert(i < NREFPAGE);
+
+    pg = (void *) (REFPAGE_BASE + i * PGSIZE);
+    if ((r = sys_page_map(0, va, 0, pg, perm)) < 0)
+	panic("refpage_lend: sys_page_map: %e", r);
+    sys_page_unmap(0, va);
+
+    refcnt[i] = 1;
+    rxpage[i] = rx;
+    nrx += rx;
+    nfree--;
+    return pg;
+}
+
+// Lend a page of data to send, waiting for a free slot if the pool is
+// full.  Slots are freed as sent data is acknowledged, which needs
+// received packets, so NREFPAGE_RX keeps some free for those.
+void *
+refpage_lend(void *va, int perm) {
+    void *pg;
+
+    while (!(pg = refpage_trylend(va, perm, 0)))
+	thread_wait(&nfree, 0, (uint32_t)~0);
+    return pg;
+}
+
+// Lend a page holding a received packet, or return 0 if received
+// packets already hold NREFPAGE_RX slots or the pool is full.
+void *
+refpage_lend_rx(void *va, int perm) {
+    return refpage_trylend(va, perm, 1);
+}
+
+// Is 'addr' in a page lent to the stack?
+int
+refpage_lent(void *addr) {
+    return refpage_slot(addr) >= 0;
+}
+
+void
+refpage_take(void *addr) {
+    int i = refpage_slot(addr);
+
+    if (i >= 0) {
+	assert(refcnt[i] > 0);
+	refcnt[i]++;
+    }
+}
+
+void
+refpage_put(void *addr) {
+    int i = refpage_slot(addr);
+
+    if (i < 0)
+	return;
+    assert(refcnt[i] > 0);
+    if (--refcnt[i] == 0) {
+	sys_page_unmap(0, (void *) (REFPAGE_BASE + i * PGSIZE));
+	nrx -= rxpage[i];
+	rxpage[i] = 0;
+	nfree++;
+	thread_wakeup(&nfree);
+    }
+}
+
+// Can a pbuf whose payload starts at 'addr' grow 'n' bytes to the front?
+// Only within the same lent page, where those bytes are the headers of
+// a received packet that lwIP hid earlier.
+int
+refpage_can_grow(void *addr, int n) {
+    int i = refpage_slot(addr);
+
+    return i >= 0 && refpage_slot((char *) addr - n) == i;
+}
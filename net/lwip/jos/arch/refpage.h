@@ -0,0 +1,27 @@
+#ifndef JOS_ARCH_REFPAGE_H
+#define JOS_ARCH_REFPAGE_H
+
+#include <inc/types.h>
+
+// Pages lent to lwIP to avoid copies.  The network server moves a page
+// of data it was sent, or a received packet, into the pool with
+// refpage_lend, and lwIP refers to it from PBUF_ROM pbufs until it is
+// done with the data (for sends, until the data is acknowledged).
+// Each pbuf holds a reference on its page (see PBUF_ROM_TAKE and
+// PBUF_ROM_PUT in lwipopts.h); the page is unmapped when the last
+// reference goes away.
+// Received packets may only fill NREFPAGE_RX of the pool, so that
+// lwIP holding on to them can't starve sends of pages.
+
+#define REFPAGE_BASE	0x10400000
+#define NREFPAGE	128
+#define NREFPAGE_RX	(NREFPAGE / 2)
+
+void *refpage_lend(void *va, int perm);
+void *refpage_lend_rx(void *va, int perm);
+int refpage_lent(void *addr);
+int refpage_can_grow(void *addr, int n);
+void refpage_take(void *addr);
+void refpage_put(void *addr);
+
+#endif
@@ -31,30 +31,63 @@ thread_wakeup(volatile uint32_t *addr) {
     }
 }
 
+// Can 'tc' run, or is it still in thread_wait?
+// '*now' caches the time across calls; it is 0 until the time is needed.
+static int
+thread_ready(struct thread_context *tc, uint32_t *now) {
+    if (!tc->tc_waiting || tc->tc_wakeup)
+	return 1;
+    if (tc->tc_wait_addr && *tc->tc_wait_addr != tc->tc_wait_val)
+	return 1;
+    if (tc->tc_wait_msec == (uint32_t)~0)
+	return 0;
+    if (!*now)
+	*now = time_msec();
+    return *now >= tc->tc_wait_msec;
+}
+
+// Wait until *addr != val (if addr is set), thread_wakeup(addr),
+// or time_msec() reaches msec.
 void
 thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec) {
-    uint32_t s = sys_time_msec();
-    uint32_t p = s;
+    uint32_t now = 0;
 
     cur_tc->tc_wait_addr = addr;
+    cur_tc->tc_wait_val = val;
+    cur_tc->tc_wait_msec = msec;
     cur_tc->tc_wakeup = 0;
+    cur_tc->tc_waiting = 1;
 
-    while (p < msec) {
-	if (p < s)
-	    break;
-	if (addr && *addr != val)
-	    break;
-	if (cur_tc->tc_wakeup)
-	    break;
-
+    while (!thread_ready(cur_tc, &now)) {
 	thread_yield();
-	p = sys_time_msec();
+	now = 0;
+	// Nothing else can run either; let other environments
+	if (!thread_ready(cur_tc, &now))
+	    sys_yield();
+	now = 0;
     }
 
+    cur_tc->tc_waiting = 0;
     cur_tc->tc_wait_addr = 0;
     cur_tc->tc_wakeup = 0;
 }
 
+// Return 0 if some other thread can run now, otherwise the earliest
+// time_msec() at which a waiting thread times out (~0 if none do).
+uint32_t
+thread_next_deadline(void) {
+    struct thread_context *tc;
+    uint32_t now = 0, deadline = ~0;
+
+    for (tc = thread_queue.tq_first; tc; tc = tc->tc_queue_link) {
+	if (thread_ready(tc, &now))
+	    return 0;
+	if (tc->tc_wait_msec < deadline)
+	    deadline = tc->tc_wait_msec;
+    }
+    return deadline;
+}
+
 int
 thread_onhalt(void (*fun)(thread_id_t)) {
     if (cur_tc->tc_nonhalt >= THREAD_NUM_ONHALT)
@@ -146,12 +179,34 @@ thread_halt() {
     exit();
 }
 
+// Take the first thread that can run off the queue, or return 0.
+static struct thread_context *
+thread_pick(void) {
+    struct thread_context *tc, *first = 0;
+    uint32_t now = 0;
+
+    for (;;) {
+	tc = threadq_pop(&thread_queue);
+	if (!tc || thread_ready(tc, &now))
+	    return tc;
+	threadq_push(&thread_queue, tc);
+	if (!first)
+	    first = tc;
+	else if (tc == first)
+	    return 0;
+    }
+}
+
 void
 thread_yield(void) {
-    struct thread_context *next_tc = threadq_pop(&thread_queue);
+    struct thread_context *next_tc;
 
-    if (!next_tc)
-	return;
+    while (!(next_tc = thread_pick())) {
+	// a halting thread must hand over to a waiting one
+	if (cur_tc || !thread_queue.tq_first)
+	    return;
+	sys_yield();
+    }
 
     if (cur_tc) {
 	if (jos_setjmp(&cur_tc->tc_jb) != 0)
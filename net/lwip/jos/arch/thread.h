@@ -13,6 +13,7 @@ int thread_onhalt(void (*fun)(thread_id_t));
 int thread_create(thread_id_t *tid, const char *name, 
 		void (*entry)(uint32_t), uint32_t arg);
 void thread_yield(void);
+uint32_t thread_next_deadline(void);
 void thread_halt(void);
 
 #endif
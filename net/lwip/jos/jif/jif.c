@@ -34,6 +34,7 @@
 #include <inc/ns.h>
 
 #include <jif/jif.h>
+#include <arch/refpage.h>
 
 #include "lwip/opt.h"
 #include "lwip/def.h"
@@ -69,6 +70,105 @@ low_level_init(struct netif *netif)
     netif->hwaddr[5] = 0x56;
 }
 
+/*
+ * The output request being filled in: frames the stack sends are
+ * gathered into one NSREQ_OUTPUT, which goes to the output environment
+ * when it fills up or when the network server calls jif_flush().
+ */
+static struct jif_outreq *outreq;	/* 0 if there is no request */
+static struct IpcPage outpgs[NSREQ_OUTPUT_NPAGES];
+static int outnpg;			/* pages in outpgs */
+static int outdata;			/* bytes used in outreq->jr_data */
+
+/*
+ * jif_frame():
+ *
+ * Add the frame in pbuf chain p to the output request.  Pbufs referring
+ * to pages lent to the stack (file data from sendfile, received frames)
+ * are passed by page if 'byref' is set; everything else is copied into
+ * the request's jr_data.
+ * Returns 0, or -1 (changing nothing) if the frame doesn't fit.
+ */
+static int
+jif_frame(struct pbuf *p, int byref)
+{
+    struct pbuf *q;
+    struct jif_outpkt *pkt;
+    struct jif_frag *f = 0;
+    int npg = outnpg, ndata = outdata;
+    int maxdata = PGSIZE - sizeof(struct jif_outreq);
+
+    if (outreq->jr_npkt == JIF_OUTPKT_MAX)
+	return -1;
+    pkt = &outreq->jr_pkts[outreq->jr_npkt];
+    pkt->jo_nfrag = 0;
+
+    for (q = p; q != NULL; q = q->next) {
+	if (q->len == 0)
+	    continue;
+
+	if (byref && q->type == PBUF_ROM && refpage_lent(q->payload)
+	    && PGOFF(q->payload) + q->len <= PGSIZE) {
+	    if (pkt->jo_nfrag == TXFRAG_MAX || npg == NSREQ_OUTPUT_NPAGES)
+		return -1;
+	    f = &pkt->jo_frags[pkt->jo_nfrag++];
+	    f->jf_page = npg;
+	    f->jf_off = PGOFF(q->payload);
+	    f->jf_len = q->len;
+	    outpgs[npg].ip_srcva = ROUNDDOWN(q->payload, PGSIZE);
+	    outpgs[npg].ip_dstpg = npg;
+	    outpgs[npg].ip_perm = PTE_P|PTE_U;
+	    npg++;
+	    continue;
+	}
+
+	if (ndata + q->len > maxdata)
+	    return -1;
+	memcpy(&outreq->jr_data[ndata], q->payload, q->len);
+	if (f && f->jf_page == 0) {
+	    f->jf_len += q->len;
+	} else {
+	    if (pkt->jo_nfrag == TXFRAG_MAX)
+		return -1;
+	    f = &pkt->jo_frags[pkt->jo_nfrag++];
+	    f->jf_page = 0;
+	    f->jf_off = offsetof(struct jif_outreq, jr_data) + ndata;
+	    f->jf_len = q->len;
+	}
+	ndata += q->len;
+    }
+
+    /* The lent pages must stay mapped until the request has been sent,
+       even if the stack is done with them before then. */
+    for (; outnpg < npg; outnpg++)
+	refpage_take(outpgs[outnpg].ip_srcva);
+    outdata = ndata;
+    outreq->jr_npkt++;
+    return 0;
+}
+
+/*
+ * jif_flush():
+ *
+ * Send the frames gathered so far to the output environment.
+ */
+void
+jif_flush(struct netif *netif)
+{
+    struct jif *jif = netif->state;
+    int i;
+
+    if (!outreq)
+	return;
+
+    if (outreq->jr_npkt > 0)
+	ipc_send_pages(jif->envid, NSREQ_OUTPUT, outpgs, outnpg);
+    for (i = 1; i < outnpg; i++)
+	refpage_put(outpgs[i].ip_srcva);
+    sys_page_unmap(0, outreq);
+    outreq = 0;
+}
+
 /*
  * low_level_output():
  *
@@ -80,32 +180,27 @@ low_level_init(struct netif *netif)
 static err_t
 low_level_output(struct netif *netif, struct pbuf *p)
 {
-    int r = sys_page_alloc(0, (void *)PKTMAP, PTE_U|PTE_W|PTE_P);
-    if (r < 0)
-	panic("jif: could not allocate page of memory");
-    struct jif_pkt *pkt = (struct jif_pkt *)PKTMAP;
-
-    struct jif *jif;
-    jif = netif->state;
+    int r;
 
-    char *txbuf = pkt->jp_data;
-    int txsize = 0;
-    struct pbuf *q;
-    for (q = p; q != NULL; q = q->next) {
-	/* Send the data from the pbuf to the interface, one pbuf at a
-	   time. The size of the data in each pbuf is kept in the ->len
-	   variable. */
-
-	if (txsize + q->len > 2000)
-	    panic("oversized packet, fragment %d txsize %d\n", q->len, txsize);
-	memcpy(&txbuf[txsize], q->payload, q->len);
-	txsize += q->len;
-    }
+    if (outreq && jif_frame(p, 1) == 0)
+	return ERR_OK;
+    jif_flush(netif);
 
-    pkt->jp_len = txsize;
+    /* A fresh page for each request: the driver sends its contents in
+       place, so it must never be reused. */
+    r = sys_page_alloc(0, (void *)PKTMAP, PTE_U|PTE_W|PTE_P);
+    if (r < 0)
+	panic("jif: could not allocate page of memory");
+    outreq = (struct jif_outreq *)PKTMAP;
+    outreq->jr_npkt = 0;
+    outpgs[0].ip_srcva = outreq;
+    outpgs[0].ip_dstpg = 0;
+    outpgs[0].ip_perm = PTE_P|PTE_W|PTE_U;
+    outnpg = 1;
+    outdata = 0;
 
-    ipc_send(jif->envid, NSREQ_OUTPUT, (void *)pkt, PTE_P|PTE_W|PTE_U);
-    sys_page_unmap(0, (void *)pkt);
+    if (jif_frame(p, 1) < 0 && jif_frame(p, 0) < 0)
+	panic("oversized packet, length %d\n", p->tot_len);
 
     return ERR_OK;
 }
@@ -122,8 +217,19 @@ low_level_input(void *va)
 {
     struct jif_pkt *pkt = (struct jif_pkt *)va;
     s16_t len = pkt->jp_len;
+    struct pbuf *p;
+
+    /* If the packet's page has been lent to us, refer to it in place. */
+    if (refpage_lent(va)) {
+	p = pbuf_alloc(PBUF_RAW, len, PBUF_ROM);
+	if (p == 0)
+	    return 0;
+	p->payload = pkt->jp_data;
+	PBUF_ROM_TAKE(p);
+	return p;
+    }
 
-    struct pbuf *p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
+    p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
     if (p == 0)
 	return 0;
 
@@ -45,6 +45,15 @@ void *memcpy(void *dst, const void *src, size_t n);
 #define TCP_SND_QUEUELEN	(2 * TCP_SND_BUF/TCP_MSS)
 //#define TCP_SND_QUEUELEN	16
 
+// Zero-copy sends: PBUF_ROM pbufs may refer to pages lent to the stack
+// by the network server, which must stay mapped while they do.
+void refpage_take(void *addr);
+void refpage_put(void *addr);
+int refpage_can_grow(void *addr, int n);
+#define PBUF_ROM_TAKE(p)	refpage_take((p)->payload)
+#define PBUF_ROM_PUT(p)		refpage_put((p)->payload)
+#define PBUF_ROM_CAN_GROW(p, n)	refpage_can_grow((p)->payload, (n))
+
 // Print error messages when we run out of memory
 #define LWIP_DEBUG	1
 //#define TCP_DEBUG	LWIP_DBG_ON
@@ -5,14 +5,9 @@
 #define MASK "255.255.255.0"
 #define DEFAULT "10.0.2.2"
 
-#define TIMER_INTERVAL 250
-
 // Virtual address at which to receive page mappings containing client requests.
 #define QUEUE_SIZE	20
-#define REQVA		(0x0ffff000 - QUEUE_SIZE * PGSIZE)
-
-/* timer.c */
-void timer(envid_t ns_envid, uint32_t initial_to);
+#define REQVA		(0x0ffff000 - QUEUE_SIZE * NSREQ_NPAGES * PGSIZE)
 
 /* input.c */
 void input(envid_t ns_envid);
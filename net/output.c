@@ -12,14 +12,18 @@ output(envid_t ns_envid)
 	//	- send the packet to the device driver
 	
 	uint32_t req, whom;
-	int perm;
-	struct jif_pkt *pkt;
+	int perm, i, j, n, r, npg;
+	struct jif_outreq *rq;
+	struct jif_outpkt *pkt;
+	struct jif_frag *f;
+	struct TxPkt pkts[JIF_OUTPKT_MAX];
 
 	cprintf("Hey, I am OUTPUT, %x\n", sys_getenvid());
 
 	while (1) {
 		perm = 0;
-		req = ipc_recv((int32_t *) &whom, (void *) PKTMAP, &perm);
+		req = ipc_recv_pages((int32_t *) &whom, (void *) PKTMAP,
+				     NSREQ_OUTPUT_NPAGES, &perm);
 
 		// All requests must contain an argument page
 		if (!(perm & PTE_P)) {
@@ -32,15 +36,42 @@ output(envid_t ns_envid)
 			continue; // just leave it hanging...
 		}
 
+		npg = 1;
 		switch (req) {
 		case NSREQ_OUTPUT:
-			pkt = (struct jif_pkt *) PKTMAP;
-			sys_transmit_packet((void *)pkt->jp_data, (uint32_t)pkt->jp_len);
+			// All the frames go to the driver at once,
+			// and their pieces are sent in place
+			rq = (struct jif_outreq *) PKTMAP;
+			for (i = 0; i < rq->jr_npkt && i < JIF_OUTPKT_MAX; i++) {
+				pkt = &rq->jr_pkts[i];
+				for (j = 0; j < pkt->jo_nfrag && j < TXFRAG_MAX; j++) {
+					f = &pkt->jo_frags[j];
+					pkts[i].tp_frags[j].tf_va = (void *) PKTMAP
+						+ f->jf_page * PGSIZE + f->jf_off;
+					pkts[i].tp_frags[j].tf_len = f->jf_len;
+					if (f->jf_page >= npg)
+						npg = f->jf_page + 1;
+				}
+				pkts[i].tp_nfrag = j;
+			}
+			// When the ring is full, block until the NIC
+			// has sent a frame rather than dropping frames
+			for (n = 0; n < i; n += r) {
+				r = sys_transmit_packets(pkts + n, i - n);
+				if (r == -E_TX_FULL) {
+					sys_transmit_wait();
+					r = 0;
+				} else if (r < 0) {
+					cprintf("OUTPUT: transmit failed: %e\n", r);
+					break;
+				}
+			}
 			break;
 		default:
 			cprintf("OUTPUT: Invalid request code %d from %08x\n", whom, req);
 		}
 
-		sys_page_unmap(0, (void*) PKTMAP);
+		for (i = 0; i < npg; i++)
+			sys_page_unmap(0, (void*) PKTMAP + i * PGSIZE);
 	}
 }
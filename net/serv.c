@@ -11,6 +11,7 @@
 
 #include <arch/perror.h>
 #include <arch/thread.h>
+#include <arch/refpage.h>
 #include <lwip/sockets.h>
 #include <lwip/netif.h>
 #include <lwip/stats.h>
@@ -43,7 +44,6 @@ static struct timer_thread t_arp;
 static struct timer_thread t_tcpf;
 static struct timer_thread t_tcps;
 
-static envid_t timer_envid;
 static envid_t input_envid;
 static envid_t output_envid;
 
@@ -64,7 +64,7 @@ get_buffer() {
 	return 0;
     }
 
-    va = (void *)(REQVA + i * PGSIZE);
+    va = (void *)(REQVA + i * NSREQ_NPAGES * PGSIZE);
     buse[i] = 1;
     
     return va;
@@ -72,10 +72,16 @@ get_buffer() {
 
 static void
 put_buffer(void *va) {
-    int i = ((uint32_t)va - REQVA) / PGSIZE;
+    int i = ((uint32_t)va - REQVA) / (NSREQ_NPAGES * PGSIZE);
     buse[i] = 0;
 }
 
+// Is a page mapped at va?
+static int
+page_present(void *va) {
+    return (vpd[PDX(va)] & PTE_P) && (vpt[VPN(va)] & PTE_P);
+}
+
 static void
 lwip_init(struct netif *nif, void *if_state,
 	  uint32_t init_addr, uint32_t init_mask, uint32_t init_gw)
@@ -101,7 +107,7 @@ net_timer(uint32_t arg)
     struct timer_thread *t = (struct timer_thread *) arg;
 
     for (;;) {
-	uint32_t cur = sys_time_msec();
+	uint32_t cur = time_msec();
 
 	lwip_core_lock();
 	t->func();
@@ -227,11 +233,36 @@ serve_recv(envid_t envid, struct Nsreq_recv* rq) {
 
 static void
 serve_send(envid_t envid, struct Nsreq_send* rq) {
-    int r = lwip_send(rq->req_s, &rq->req_dataptr, rq->req_size, rq->req_flags);
+    // The request page goes away when we're done, so lwIP must copy.
+    int r = lwip_send(rq->req_s, &rq->req_dataptr, rq->req_size,
+		      rq->req_flags & ~MSG_NOCOPY);
     if (r < 0) perror("serve_send");
     ipc_send(envid, r, 0, 0);
 }
 
+static void
+serve_sendpage(envid_t envid, struct Nsreq_sendpage* rq) {
+    int r;
+    char *pg;
+
+    pg = (char *)rq + PGSIZE;
+    if (!page_present(pg)
+	|| rq->req_offset < 0 || rq->req_size < 0
+	|| rq->req_offset + rq->req_size > PGSIZE) {
+	ipc_send(envid, -E_INVAL, 0, 0);
+	return;
+    }
+
+    // Lend the data page to lwIP, which refers to it until the data
+    // has been acknowledged, rather than copying it.
+    pg = refpage_lend(pg, PTE_P|PTE_U);
+    r = lwip_send(rq->req_s, pg + rq->req_offset, rq->req_size,
+		  rq->req_flags | MSG_NOCOPY);
+    if (r < 0) perror("serve_sendpage");
+    refpage_put(pg);
+    ipc_send(envid, r, 0, 0);
+}
+
 static void
 serve_socket(envid_t envid, struct Nsreq_socket *rq) {
     int r = lwip_socket(rq->req_domain, rq->req_type, rq->req_protocol);
@@ -240,26 +271,28 @@ serve_socket(envid_t envid, struct Nsreq_socket *rq) {
 }
 
 static void
-process_timer(envid_t envid) {
-    uint32_t start, now, to;
+net_recv(envid_t envid, void *va) {
+    char *pg;
+    int i;
 
-    if (envid != timer_envid) {
-	cprintf("NS: received timer interrupt from envid %x not timer env\n", envid);
-	return;
+    // One received frame per page
+    for (i = 0; i < NSREQ_NPAGES; i++, va = (char *)va + PGSIZE) {
+	if (!page_present(va))
+	    break;
+
+	// Lend the page to lwIP so the packet needn't be copied into a
+	// pbuf.  Don't wait for room in the pool, though: the pages in it
+	// may be waiting for acknowledgements in packets we have yet to
+	// receive.  Received packets only get their share of the pool,
+	// leaving the rest to serve_sendpage.
+	if ((pg = refpage_lend_rx(va, PTE_P|PTE_U|PTE_W))) {
+	    jif_input(&nif, pg + NSREQ_INPUT_OFFSET);
+	    refpage_put(pg);
+	} else {
+	    jif_input(&nif, (char *)va + NSREQ_INPUT_OFFSET);
+	    sys_page_unmap(0, va);
+	}
     }
-
-    start = sys_time_msec();
-    thread_yield();
-    now = sys_time_msec();
-
-    to = TIMER_INTERVAL - (now - start);
-    ipc_send(envid, to, 0, 0);
-}
-
-static void
-net_recv(envid_t envid, struct jif_pkt* pkt) {
-    jif_input(&nif, (void *)pkt);
-    sys_page_unmap(0, (void*)pkt);
 }
 
 struct st_args {
@@ -271,6 +304,7 @@ struct st_args {
 static void
 serve_thread(uint32_t a) {
 	struct st_args *args = (struct st_args *)a;
+	int i;
 
 	switch (args->req) {
 	  case NSREQ_ACCEPT:
@@ -297,11 +331,14 @@ serve_thread(uint32_t a) {
 	  case NSREQ_SEND:
 		serve_send(args->whom, (struct Nsreq_send*)args->va);
 		break;
+	  case NSREQ_SENDPAGE:
+		serve_sendpage(args->whom, (struct Nsreq_sendpage*)args->va);
+		break;
 	  case NSREQ_SOCKET:
 		serve_socket(args->whom, (struct Nsreq_socket*)args->va);
 		break;
 	  case NSREQ_INPUT:
-		net_recv(args->whom, (struct jif_pkt*)args->va);
+		net_recv(args->whom, args->va);
 		break;
 	  default:
 		cprintf("Invalid request code %d from %08x\n", args->whom, args->req);
@@ -309,7 +346,9 @@ serve_thread(uint32_t a) {
 	}
 
 	put_buffer(args->va);
-	sys_page_unmap(0, (void*) args->va);
+	for (i = 0; i < NSREQ_NPAGES; i++)
+		if (page_present((char *) args->va + i * PGSIZE))
+			sys_page_unmap(0, (char *) args->va + i * PGSIZE);
 	free(args);
 }
 
@@ -321,21 +360,25 @@ serve(void) {
 	void *va;
 	
 	while (1) {
+		// Run the other threads until they all wait
+		while (thread_next_deadline() == 0)
+			thread_yield();
+
+		// Send what the stack has queued before waiting
+		jif_flush(&nif);
+
+		// Wait for a request, or until a thread's wait times out
 		perm = 0;
 		va = get_buffer();
-		req = ipc_recv((int32_t *) &whom, (void *) va, &perm);
-		if (debug) {
-			cprintf("ns req %d from %08x\n", req, whom);
-		}
-
-		// first take care of requests that do not contain an argument page
-		switch (req) {
-		  case NSREQ_TIMER:
-			process_timer(whom);
+		req = ipc_recv_timeout((int32_t *) &whom, (void *) va,
+				       NSREQ_NPAGES, &perm,
+				       thread_next_deadline());
+		if (req == -E_TIMEOUT) {
 			put_buffer(va);
 			continue;
-		  default:
-			break;
+		}
+		if (debug) {
+			cprintf("ns req %d from %08x\n", req, whom);
 		}
 
 		// All remaining requests must contain an argument page
@@ -370,19 +413,10 @@ tmain(uint32_t arg) {
 void
 umain(void)
 {
-	envid_t ns_envid = sys_getenvid();
+	envid_t ns_envid = vsys.vs_envid;
 
         binaryname = "ns";
 
-	// fork off the timer thread which will send us periodic messages
-	timer_envid = fork();
-	if (timer_envid < 0)
-		panic("error forking");
-	else if (timer_envid == 0) {
-		timer(ns_envid, TIMER_INTERVAL);
-		return;
-	}
-
 	// fork off the input thread which will poll the NIC driver for input
 	// packets
 	input_envid = fork();
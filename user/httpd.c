@@ -3,20 +3,38 @@
 #include <lwip/inet.h>
 
 #define PORT 80
-#define VERSION "0.1"
-#define HTTP_VERSION "1.0"
+#define VERSION "0.2"
+#define HTTP_VERSION "1.1"
 
 #define E_BAD_REQ	1000
 
-#define BUFFSIZE 512
+#define BUFFSIZE 2048
+#define RECVSIZE 1500	// nsipc_recv returns at most a packet's worth
 #define MAXPENDING 5	// Max connection requests
+#define NWORKER 4	// Environments accepting connections
+#define NCACHE 16	// Open files cached per worker
+#define MAXURL 128
 
 struct http_request {
 	int sock;
-	char *url;
-	char *version;
+	char url[MAXURL];
+	int keepalive;
 };
 
+// A cached file: the open file (and with it the file's page mappings)
+// and the response header, which only depends on the file.
+struct cache_entry {
+	char url[MAXURL];
+	int fd;
+	off_t size;
+	char header[256];
+	int header_len;
+	uint32_t used;		// for LRU replacement
+};
+
+static struct cache_entry cache[NCACHE];
+static uint32_t cache_clock;
+
 struct responce_header {
 	int code;
 	char *header;
@@ -36,6 +54,27 @@ struct error_messages {
 struct error_messages errors[] = {
 	{400, "Bad Request"},
 	{404, "Not Found"},
+	{0, 0},
+};
+
+struct mime_types {
+	const char *ext;
+	const char *type;
+};
+
+struct mime_types mime_types[] = {
+	{ "html",	"text/html" },
+	{ "htm",	"text/html" },
+	{ "txt",	"text/plain" },
+	{ "css",	"text/css" },
+	{ "js",		"application/javascript" },
+	{ "jpg",	"image/jpeg" },
+	{ "jpeg",	"image/jpeg" },
+	{ "png",	"image/png" },
+	{ "gif",	"image/gif" },
+	{ "ico",	"image/x-icon" },
+	{ "pdf",	"application/pdf" },
+	{ 0, 0 },
 };
 
 static void
@@ -45,109 +84,146 @@ die(char *m)
 	exit();
 }
 
-static void
-req_free(struct http_request *req)
+static int
+lower(int c)
 {
-	free(req->url);
-	free(req->version);
+	return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
 }
 
+// Does the 'n' bytes at 's' start with 'prefix', ignoring case?
 static int
-send_header(struct http_request *req, int code)
+prefix_match(const char *s, int n, const char *prefix)
 {
-	struct responce_header *h = headers;
-	while (h->code != 0 && h->header!= 0) {
-		if (h->code == code)
-			break;
-		h++;
-	}
-
-	if (h->code == 0)
-		return -1;
+	for (; *prefix; s++, prefix++, n--)
+		if (n == 0 || lower(*s) != lower(*prefix))
+			return 0;
+	return 1;
+}
 
-	int len = strlen(h->header);
-	if (send(req->sock, h->header, len, 0) != len) {
-		die("Failed to send bytes to client");
-	}
-	
-	return 0;
+static const char*
+mime_type(const char *file)
+{
+	const char *ext = 0;
+	struct mime_types *m;
+
+	for (; *file; file++)
+		if (*file == '.')
+			ext = file + 1;
+		else if (*file == '/')
+			ext = 0;
+	if (ext)
+		for (m = mime_types; m->ext; m++)
+			if (strcmp(m->ext, ext) == 0)
+				return m->type;
+	return "application/octet-stream";
 }
 
-static int
-send_data(struct http_request *req, int fd)
+// Find the cached entry for 'url'.  An entry whose file has changed
+// size since it was cached is dropped, so the file is opened again.
+// The size is asked of the file server: the open file descriptor's
+// copy of it isn't kept up to date with other environments' writes.
+static struct cache_entry *
+cache_lookup(const char *url)
 {
-	// LAB 6: Your code here.
-	panic("send_data not implemented");
+	struct cache_entry *c;
+	struct Stat st;
+
+	for (c = cache; c < cache + NCACHE; c++)
+		if (c->used && strcmp(c->url, url) == 0) {
+			if (stat(url, &st) < 0 || st.st_isdir
+			    || st.st_size != c->size) {
+				close(c->fd);
+				c->used = 0;
+				return 0;
+			}
+			c->used = ++cache_clock;
+			return c;
+		}
+	return 0;
 }
 
+// Open the file named by 'url' and add it to the cache,
+// replacing the least recently used entry if the cache is full.
 static int
-send_size(struct http_request *req, off_t size)
+cache_fill(const char *url, struct cache_entry **c_store)
 {
-	char buf[64];
-	int r;
+	struct cache_entry *c, *victim;
+	struct Stat st;
+	struct responce_header *h = headers;
+	int fd, r;
 
-	r = snprintf(buf, 64, "Content-Length: %ld\r\n", (long)size);
-	if (r > 63)
-		panic("buffer too small!");
+	if ((fd = open(url, O_RDONLY)) < 0)
+		return fd;
+	if ((r = fstat(fd, &st)) < 0 || st.st_isdir) {
+		close(fd);
+		return r < 0 ? r : -E_NOT_FOUND;
+	}
 
-	if (send(req->sock, buf, r, 0) != r)
-		return -1;
+	victim = cache;
+	for (c = cache; c < cache + NCACHE; c++)
+		if (c->used < victim->used)
+			victim = c;
+	c = victim;
+	if (c->used)
+		close(c->fd);
 
+	while (h->code != 200)
+		h++;
+	strcpy(c->url, url);
+	c->fd = fd;
+	c->size = st.st_size;
+	c->header_len = snprintf(c->header, sizeof(c->header),
+				 "%sContent-Length: %ld\r\n"
+				 "Content-Type: %s\r\n",
+				 h->header, (long) st.st_size, mime_type(url));
+	if (c->header_len >= sizeof(c->header))
+		panic("buffer too small!");
+	c->used = ++cache_clock;
+	*c_store = c;
 	return 0;
 }
 
-static const char*
-mime_type(const char *file)
-{
-	//TODO: for now only a single mime type
-	return "text/html";
-}
-
 static int
-send_content_type(struct http_request *req)
+send_header(struct http_request *req, struct cache_entry *c)
 {
-	char buf[128];
+	char buf[320];
 	int r;
-	const char *type;
-
-	type = mime_type(req->url);
-	if (!type)
-		return -1;
 
-	r = snprintf(buf, 128, "Content-Type: %s\r\n", type);
-	if (r > 127)
+	r = snprintf(buf, sizeof(buf), "%sConnection: %s\r\n\r\n", c->header,
+		     req->keepalive ? "keep-alive" : "close");
+	if (r >= sizeof(buf))
 		panic("buffer too small!");
 
-	if (send(req->sock, buf, r, 0) != r)
+	if (send(req->sock, buf, r, MSG_MORE) != r)
 		return -1;
 
 	return 0;
 }
 
 static int
-send_header_fin(struct http_request *req)
+send_data(struct http_request *req, struct cache_entry *c)
 {
-	char *fin = "\r\n";
-	int fin_len = strlen(fin);
-
-	if (send(req->sock, fin, fin_len, 0) != fin_len)
-		return -1;
+	int r;
 
+	if (c->size == 0)
+		return 0;
+	// The file's pages go straight from the file server
+	// to the network server.
+	if ((r = sendfile(req->sock, c->fd, 0, c->size)) != c->size)
+		return r < 0 ? r : -1;
 	return 0;
 }
 
-// given a request, this function creates a struct http_request
+// Parse the request at the 'len' bytes at 'request' into 'req'.
+// The request ends at the blank line ending its headers.
 static int
-http_request_parse(struct http_request *req, char *request)
+http_request_parse(struct http_request *req, char *request, int len)
 {
-	const char *url;
-	const char *version;
-	int url_len, version_len;
+	char *end = request + len;
+	char *url, *version, *line, *next;
+	int url_len;
 
-	if (!req)
-		return -1;
-
-	if (strncmp(request, "GET ", 4) != 0)
+	if (len < 4 || strncmp(request, "GET ", 4) != 0)
 		return -E_BAD_REQ;
 
 	// skip GET
@@ -155,25 +231,37 @@ http_request_parse(struct http_request *req, char *request)
 
 	// get the url
 	url = request;
-	while (*request && *request != ' ')
+	while (request < end && *request != ' ' && *request != '\r'
+	       && *request != '\n')
 		request++;
 	url_len = request - url;
-
-	req->url = malloc(url_len + 1);
+	if (url_len == 0 || url_len >= MAXURL - sizeof("index.html"))
+		return -E_BAD_REQ;
 	memmove(req->url, url, url_len);
 	req->url[url_len] = '\0';
-
-	// skip space
-	request++;
-
-	version = request;
-	while (*request && *request != '\n')
-		request++;
-	version_len = request - version;
-
-	req->version = malloc(version_len + 1);
-	memmove(req->version, version, version_len);
-	req->version[version_len] = '\0';
+	if (req->url[url_len - 1] == '/')
+		strcpy(req->url + url_len, "index.html");
+
+	// HTTP/1.1 keeps the connection open by default, older versions
+	// (and simple requests without a version) close it.
+	version = request + 1;
+	req->keepalive = (version < end
+			  && prefix_match(version, end - version, "HTTP/1.1"));
+
+	// look for a Connection: header overriding the default
+	for (line = strchr(version, '\n'); line && line + 1 < end; line = next) {
+		line++;
+		next = strchr(line, '\n');
+		if (prefix_match(line, end - line, "Connection:")) {
+			line += sizeof("Connection:") - 1;
+			while (*line == ' ')
+				line++;
+			if (prefix_match(line, end - line, "close"))
+				req->keepalive = 0;
+			else if (prefix_match(line, end - line, "keep-alive"))
+				req->keepalive = 1;
+		}
+	}
 
 	// no entity parsing
 
@@ -192,18 +280,20 @@ send_error(struct http_request *req, int code)
 			break;
 		e++;
 	}
-	
+
 	if (e->code == 0)
 		return -1;
 
 	r = snprintf(buf, 512, "HTTP/" HTTP_VERSION" %d %s\r\n"
 			       "Server: jhttpd/" VERSION "\r\n"
-			       "Connection: close"
+			       "Connection: close\r\n"
 			       "Content-type: text/html\r\n"
 			       "\r\n"
 			       "<html><body><p>%d - %s</p></body></html>\r\n",
 			       e->code, e->msg, e->code, e->msg);
 
+	// errors always close the connection
+	req->keepalive = 0;
 	if (send(req->sock, buf, r, 0) != r)
 		return -1;
 
@@ -214,76 +304,98 @@ static int
 send_file(struct http_request *req)
 {
 	int r;
-	off_t file_size = -1;
-	int fd;
-
-	// open the requested url for reading
-	// if the file does not exist, send a 404 error using send_error
-	// if the file is a directory, send a 404 error using send_error
-	// set file_size to the size of the file
-
-	// LAB 6: Your code here.
-	panic("send_file not implemented");
+	struct cache_entry *c;
 
-	if ((r = send_header(req, 200)) < 0)
-		goto end;
+	// look up the requested url, opening it if it isn't cached
+	// if the file does not exist or is a directory, send a 404 error
+	if (!(c = cache_lookup(req->url))
+	    && (r = cache_fill(req->url, &c)) < 0)
+		return send_error(req, 404);
 
-	if ((r = send_size(req, file_size)) < 0)
-		goto end;
+	if ((r = send_header(req, c)) < 0)
+		return r;
 
-	if ((r = send_content_type(req)) < 0)
-		goto end;
-
-	if ((r = send_header_fin(req)) < 0)
-		goto end;
-
-	r = send_data(req, fd);
+	return send_data(req, c);
+}
 
-end:
-	close(fd);
-	return r;
+// Find the blank line that ends a request's headers in the 'len' bytes
+// at 'buf', and return a pointer just past it, or 0 if it isn't there yet.
+static char *
+request_end(char *buf, int len)
+{
+	int i;
+
+	for (i = 0; i + 1 < len; i++) {
+		if (buf[i] != '\n')
+			continue;
+		if (buf[i + 1] == '\n')
+			return buf + i + 2;
+		if (i + 2 < len && buf[i + 1] == '\r' && buf[i + 2] == '\n')
+			return buf + i + 3;
+	}
+	return 0;
 }
 
+// Serve requests on 'sock' until the client closes the connection
+// or a request doesn't ask to keep it open.
 static void
 handle_client(int sock)
 {
 	struct http_request con_d;
 	int r;
-	char buffer[BUFFSIZE];
-	int received = -1;
+	char buffer[BUFFSIZE + 1];
+	int len, received, reqlen;
+	char *end;
 	struct http_request *req = &con_d;
 
-	while (1) 
+	len = 0;
+	while (1)
 	{
-		// Receive message
-		if ((received = recv(sock, buffer, BUFFSIZE, 0)) < 0)
-			panic("failed to read");
-
-		memset(req, 0, sizeof(req));
+		// Receive until we have a complete request,
+		// which may already be buffered if the client pipelines
+		buffer[len] = '\0';
+		while (!(end = request_end(buffer, len))) {
+			if (len == BUFFSIZE) {
+				memset(req, 0, sizeof(*req));
+				req->sock = sock;
+				send_error(req, 400);
+				goto done;
+			}
+			if ((received = recv(sock, buffer + len,
+					     MIN(RECVSIZE, BUFFSIZE - len), 0)) <= 0)
+				goto done;
+			len += received;
+			buffer[len] = '\0';
+		}
+		reqlen = end - buffer;
 
+		memset(req, 0, sizeof(*req));
 		req->sock = sock;
 
-		r = http_request_parse(req, buffer);
+		r = http_request_parse(req, buffer, reqlen);
 		if (r == -E_BAD_REQ)
 			send_error(req, 400);
 		else if (r < 0)
 			panic("parse failed");
-		else
-			send_file(req);
+		else if (send_file(req) < 0)
+			break;
 
-		req_free(req);
+		if (!req->keepalive)
+			break;
 
-		// no keep alive
-		break;
+		// keep any pipelined requests
+		memmove(buffer, end, len - reqlen);
+		len -= reqlen;
 	}
 
+done:
 	closesocket(sock);
 }
 
 int
 umain(void)
 {
-	int serversock, clientsock;
+	int serversock, clientsock, i;
 	struct sockaddr_in server, client;
 
 	binaryname = "jhttpd";
@@ -300,7 +412,7 @@ umain(void)
 
 	// Bind the server socket
 	if (bind(serversock, (struct sockaddr *) &server,
-		 sizeof(server)) < 0) 
+		 sizeof(server)) < 0)
 	{
 		die("Failed to bind the server socket");
 	}
@@ -309,12 +421,21 @@ umain(void)
 	if (listen(serversock, MAXPENDING) < 0)
 		die("Failed to listen on server socket");
 
+	// Fork a pool of workers that all accept on the server socket,
+	// so that a slow or idle keep-alive client doesn't hold up others.
+	for (i = 1; i < NWORKER; i++) {
+		if ((clientsock = fork()) < 0)
+			die("Failed to fork worker");
+		if (clientsock == 0)
+			break;
+	}
+
 	while (1) {
 		unsigned int clientlen = sizeof(client);
 		// Wait for client connection
 		if ((clientsock = accept(serversock,
 					 (struct sockaddr *) &client,
-					 &clientlen)) < 0) 
+					 &clientlen)) < 0)
 		{
 			die("Failed to accept client connection");
 		}
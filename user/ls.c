@@ -22,16 +22,15 @@ ls(const char *path, const char *prefix)
 void
 lsdir(const char *path, const char *prefix)
 {
-	int fd, n;
-	struct File f;
+	static char buf[2048];
+	uint32_t pos;
+	int n;
+	struct Fsdirent *d;
 
-	if ((fd = open(path, O_RDONLY)) < 0)
-		panic("open %s: %e", path, fd);
-	while ((n = readn(fd, &f, sizeof f)) == sizeof f)
-		if (f.f_name[0])
-			ls1(prefix, f.f_type==FTYPE_DIR, f.f_size, f.f_name);
-	if (n > 0)
-		panic("short read in directory %s", path);
+	pos = 0;
+	while ((n = readdir(path, &pos, buf, sizeof buf)) > 0)
+		for (d = (struct Fsdirent*) buf; (char*) d < buf + n; d = FSDIRENT_NEXT(d))
+			ls1(prefix, d->d_type==FTYPE_DIR, d->d_size, d->d_name);
 	if (n < 0)
 		panic("error reading directory %s: %e", path, n);
 }